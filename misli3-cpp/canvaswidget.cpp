@@ -24,7 +24,8 @@
 #include "ui_misliwindow.h"
 
 CanvasWidget::CanvasWidget(MisliWindow *misliWindow_, NoteFile *nf) :
-    detailsMenu(tr("Details"),this)
+    detailsMenu(tr("Details"),this),
+    redirectsMenu(tr("Redirected to from"),this)
 {
     hide();
 
@@ -52,16 +53,9 @@ CanvasWidget::CanvasWidget(MisliWindow *misliWindow_, NoteFile *nf) :
     setFocusPolicy(Qt::ClickFocus);
     setAcceptDrops(true);
 
-    //Prepare per tag filter actions for the context menu
+    //Prepare per tag filter actions for the context menu (the tags get known when their notefile is loaded)
     per_tag_filter_menu.setTitle("Filter per tag (hacky)");
-    for(auto tag: misliWindow->misliLibrary()->filter_menu_tags){
-        QAction *action = new QAction(tag);
-        action->setCheckable(true);
-        action->setChecked(true);
-
-        per_tag_filter_menu.addAction(action);
-        connect(action, SIGNAL(triggered()), this, SLOT(update));
-    }
+    followLibraryTags();
 
     // Set notefile
     setNoteFile(nf);
@@ -72,6 +66,65 @@ CanvasWidget::~CanvasWidget()
     delete infoLabel;
     delete move_func_timeout;
 }
+void CanvasWidget::followLibraryTags() //the per tag filter menu shows the tags of the current library
+{
+    if(library() == tagsLibrary) return;
+
+    disconnect(filterMenuTagsConnection);
+    disconnect(tagsConnection);
+    tagsLibrary = library();
+    if(tagsLibrary != nullptr){
+        filterMenuTagsConnection = connect(tagsLibrary, &Library::filterMenuTagsChanged, this, &CanvasWidget::updatePerTagFilterMenu);
+        tagsConnection = connect(tagsLibrary, &Library::tagsChanged, this, &CanvasWidget::updatePerTagFilterMenu);
+    }
+    updatePerTagFilterMenu();
+}
+void CanvasWidget::updatePerTagFilterMenu()
+{
+    Library *lib = library();
+    if(lib == nullptr) return;
+
+    //Keep the hidden tags hidden across the updates
+    QSet<QString> hiddenTags;
+    for(auto action: per_tag_filter_menu.actions()){
+        if(!action->isChecked()) hiddenTags.insert(action->data().toString());
+    }
+    per_tag_filter_menu.clear();
+
+    //The tags from the define_filter_menu_tags note if there's one, else all of them by frequency
+    QList<QPair<QString, int>> tags;
+    if(lib->filter_menu_tags.isEmpty()){
+        tags = lib->tagIndex.tagsByFrequency();
+    }else{
+        for(auto tag: lib->filter_menu_tags) tags.push_back(qMakePair(tag, lib->tagIndex.count(tag)));
+    }
+
+    for(auto tag: tags){
+        QAction *action = per_tag_filter_menu.addAction(tag.first + " (" + QString::number(tag.second) + ")");
+        action->setData(tag.first);
+        action->setCheckable(true);
+        action->setChecked(!hiddenTags.contains(tag.first));
+
+        connect(action, SIGNAL(triggered()), this, SLOT(update()));
+    }
+}
+void CanvasWidget::updateRedirectsMenu() //the notes redirecting to this notefile, from the library graph
+{
+    redirectsMenu.clear();
+    Library *lib = library();
+    if( (lib == nullptr) | (noteFile() == nullptr) ) return;
+
+    for(const LibraryGraph::Node &source: lib->graph.backlinks(LibraryGraph::noteFileNode(noteFile()->name()))){
+        QAction *action = redirectsMenu.addAction(source.first);
+        connect(action, &QAction::triggered, this, [=](){
+            NoteFile *nf = misliWindow->misliLibrary()->noteFileByName(source.first);
+            if(nf == nullptr) return;
+            setNoteFile(nf);
+            Note *nt = nf->getNoteById(source.second);
+            if(nt != nullptr) centerEyeOnNote(nt); //may be in a tile that isn't loaded
+        });
+    }
+}
 QPointF CanvasWidget::project(QPointF point)
 {
     return QPointF(projectX(point.x()),projectY(point.y()));
@@ -181,11 +234,14 @@ void CanvasWidget::paintEvent(QPaintEvent*)
     windowFrame.setSize( QSizeF(width()/heightScaleFactor(), height()/heightScaleFactor()) );
     windowFrame.moveCenter(QPointF(noteFile()->eyeX,noteFile()->eyeY));
 
+    //For the paged notefiles - ask for the tiles coming into view, they're loaded after the paint
+    noteFile()->updateResidentTiles(windowFrame);
+
     // Allowed tags
     QStringList allowedTags;
     for(auto action: per_tag_filter_menu.actions()){
         if(!action->isChecked()){
-            allowedTags.append(action->text());
+            allowedTags.append(action->data().toString());
         }
     }
 
@@ -211,14 +267,6 @@ void CanvasWidget::paintEvent(QPaintEvent*)
 
         displayed_notes++;
 
-        //Check the validity of the address string
-        if(nt->type == NoteType::redirecting){
-            if(misliWindow->misliLibrary()->noteFileByName(nt->addressString) == nullptr &&
-               nt->textForShortening!=tr("Missing note file") )
-            {
-                nt->textForShortening = tr("Missing note file");
-            }
-        }
 
         //Handle autoSize requests
         if(nt->requestAutoSize){
@@ -431,8 +479,8 @@ void CanvasWidget::doubleClick()
     if(nt!=nullptr){ //if we've clicked on a note
         if(nt->type == NoteType::redirecting){ //if it's a valid redirecting note
 
-            if(misliWindow->misliLibrary()->noteFileByName(nt->addressString)!=nullptr)
-            setNoteFile(misliWindow->misliLibrary()->noteFileByName(nt->addressString));
+            if(misliWindow->misliLibrary()->noteFileByName(nt->redirectTarget)!=nullptr)
+            setNoteFile(misliWindow->misliLibrary()->noteFileByName(nt->redirectTarget));
 
         }else if(nt->type == NoteType::textFile){
 
@@ -573,7 +621,8 @@ void CanvasWidget::handleMousePress(Qt::MouseButton button)
                 //Select all notes this one links to
                 noteUnderMouse->setSelected(true);
                 for(Link ln: noteUnderMouse->outlinks){
-                    noteFile()->getNoteById(ln.id)->setSelected(true);
+                    Note *target = noteFile()->getNoteById(ln.id);
+                    if(target != nullptr) target->setSelected(true); //may be in a tile that isn't loaded
                 }
             }
 
@@ -604,6 +653,8 @@ void CanvasWidget::handleMousePress(Qt::MouseButton button)
             contextMenu->addAction(misliWindow->ui->actionNew_note);
         }
         contextMenu->addMenu(misliWindow->ui->menuSwitch_to_another_note_file);
+        updateRedirectsMenu();
+        if(!redirectsMenu.isEmpty()) contextMenu->addMenu(&redirectsMenu);
         contextMenu->addSeparator();
         contextMenu->addAction(misliWindow->ui->actionCopy);
         contextMenu->addAction(misliWindow->ui->actionPaste);
@@ -640,7 +691,7 @@ void CanvasWidget::handleMouseRelease(Qt::MouseButton button)
         }
 
         if(nt->type == NoteType::redirecting){
-            NoteFile *nfUnderMouse = misliWindow->misliLibrary()->noteFileByName(nt->addressString);
+            NoteFile *nfUnderMouse = misliWindow->misliLibrary()->noteFileByName(nt->redirectTarget);
 
             if(nfUnderMouse != nullptr){
                 misliWindow->openNoteFileInNewTab(nfUnderMouse);
@@ -794,6 +845,31 @@ void CanvasWidget::jumpToNearestNote()
 
     unproject(mousePos().x(),mousePos().y(),x_unprojected,y_unprojected);
 
+    //A paged notefile may have no notes loaded around, so search in its index
+    if(noteFile()->isPaged){
+        QRectF nearestRect;
+        for(const PagedNoteEntry &entry: noteFile()->noteIndex){
+            result = QLineF(unproject(mousePos()), entry.rect.topLeft()).length();
+            if( nearestRect.isNull() | (result<best_result) ){
+                nearestRect = entry.rect;
+                best_result = result;
+            }
+        }
+        for(Note *nt: noteFile()->notes){ //the loaded ones may have moved
+            result = QLineF(unproject(mousePos()), nt->rect().topLeft()).length();
+            if(result<best_result){
+                nearestRect = nt->rect();
+                best_result = result;
+            }
+        }
+        if(!nearestRect.isNull()){
+            noteFile()->eyeX = nearestRect.center().x();
+            noteFile()->eyeY = nearestRect.center().y();
+            update();
+        }
+        return;
+    }
+
     int iter=0;
     for(Note *nt: noteFile()->notes){
         result = QLineF(unproject(mousePos()), nt->rect().topLeft()).length();
@@ -814,6 +890,13 @@ NoteFile* CanvasWidget::noteFile()
 {
     return currentNoteFile;
 }
+Library *CanvasWidget::library()
+{
+    MisliDesktopGui *gui = misliWindow->misliDesktopGUI;
+
+    if(gui->libraries.contains(currentLibrary)) return currentLibrary;
+    return gui->libraries.isEmpty() ? nullptr : gui->libraries.first(); //it was closed
+}
 void CanvasWidget::setNoteFile(NoteFile *newNoteFile) //This function has to not care what happens to the last NF
                                                 //Else we need no know the misliDir of the last one
 {
@@ -846,6 +929,7 @@ void CanvasWidget::setNoteFile(NoteFile *newNoteFile) //This function has to not
         }
 
     }else{ //If the newNoteFile is NOT NULL
+        newNoteFile->load(); //parse the notes on first display
         visualChangeConnection = connect(newNoteFile, SIGNAL(visualChange()), this, SLOT(update()));
 
         misliWindow->ui->makeNoteFilePushButton->hide();
@@ -855,7 +939,11 @@ void CanvasWidget::setNoteFile(NoteFile *newNoteFile) //This function has to not
 
     lastNoteFile = currentNoteFile;
     currentNoteFile = newNoteFile;
+    Library *newLibrary = misliWindow->misliDesktopGUI->libraryOf(newNoteFile);
+    if(newLibrary != nullptr) currentLibrary = newLibrary; //not for the help and the clipboard notefiles
+    followLibraryTags();
     misliWindow->updateNoteFilesListMenu();
+    misliWindow->updateDirListMenu();
     misliWindow->updateTitle();
 
     int myIndex = misliWindow->ui->tabWidget->indexOf(this);
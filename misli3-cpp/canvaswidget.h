@@ -23,6 +23,7 @@
 #include <QMenu>
 #include <QLabel>
 #include <QPushButton>
+#include <QPointer>
 
 #include "misli_desktop/misliwindow.h"
 #include "misli_desktop/mislidesktopgui.h"
@@ -63,22 +64,23 @@ public:
 
     //Properties
     NoteFile *noteFile();
-    Library *library(){
-        return misliWindow->misliDesktopGUI->misliLibrary;
-    }
+    Library *library();
 
     //Variables
     MisliWindow *misliWindow;
     Note *cpChangeNote;
     Link *linkOnControlPointDrag;
 
-    QMenu *contextMenu, detailsMenu, per_tag_filter_menu;
+    QMenu *contextMenu, detailsMenu, per_tag_filter_menu, redirectsMenu;
     QLabel *infoLabel;
     QTimer *move_func_timeout;
     QTime lastReleaseEvent;
 
 //    Library * currentDir_m=nullptr;
     NoteFile *currentNoteFile = nullptr, *lastNoteFile = nullptr;
+    Library *currentLibrary = nullptr; //of the current notefile, kept when it gets unloaded
+    QPointer<Library> tagsLibrary; //the one the per tag filter menu is connected to
+    QMetaObject::Connection filterMenuTagsConnection, tagsConnection;
     QMetaObject::Connection nfChangedConnecton;
 
     double distanceToPrimeNoteX, distanceToPrimeNoteY, resizeX, resizeY;
@@ -95,6 +97,9 @@ public slots:
     //Properties
     void setNoteFile(NoteFile* newNoteFile);
 //    void setCurrentDir(Library * newDir);
+    void followLibraryTags();
+    void updatePerTagFilterMenu();
+    void updateRedirectsMenu();
 
     //Other
     void startMove();
@@ -0,0 +1,258 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "directorywatcher.h"
+#include "global.h"
+
+DirectoryWatcher::DirectoryWatcher(QString folderPath_, QStringList nameFilters, QStringList skippedFolders, QObject *parent) :
+    QObject(parent),
+    scanner(folderPath_, nameFilters, skippedFolders)
+{
+    folderPath = folderPath_;
+    inotifyFd = -1;
+    inotifyNotifier = nullptr;
+    fallbackWatcher = nullptr;
+    isWatching = false;
+
+    debounceTimer.setSingleShot(true);
+    debounceTimer.setInterval(DIRECTORY_WATCH_DEBOUNCE);
+    connect(&debounceTimer,SIGNAL(timeout()),this,SLOT(flushPendingChanges()));
+}
+DirectoryWatcher::~DirectoryWatcher()
+{
+#ifdef Q_OS_LINUX
+    if(inotifyFd != -1) close(inotifyFd);
+#endif
+}
+void DirectoryWatcher::startWatching(QStringList filePaths, QStringList folders) //from the library's scan, so the tree isn't walked twice
+{
+    if(isWatching) return;
+    isWatching = true;
+
+    QDir dir(folderPath);
+    for(QString filePath: filePaths) knownFiles.insert(dir.relativeFilePath(filePath));
+    scanner.folders = folders;
+
+#ifdef Q_OS_LINUX
+    //One watch per folder, no matter how many notefiles are in it
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFd != -1){
+        for(QString folder: folders) watchFolder(folder);
+
+        if(!watchedFolders.values().contains(QString())){ //the top one failed
+            close(inotifyFd);
+            inotifyFd = -1;
+            watchedFolders.clear();
+        }else{
+            inotifyNotifier = new QSocketNotifier(inotifyFd, QSocketNotifier::Read, this);
+            connect(inotifyNotifier,SIGNAL(activated(int)),this,SLOT(readInotifyEvents()));
+        }
+    }
+#endif
+
+    if(inotifyFd == -1){
+        qDebug()<<"[DirectoryWatcher::startWatching]No inotify, watching the files one by one:"<<folderPath;
+
+        fallbackWatcher = new QFileSystemWatcher(this);
+        for(QString folder: folders) watchFolder(folder);
+        for(QString name: knownFiles) fallbackWatcher->addPath(dir.filePath(name));
+
+        connect(fallbackWatcher,SIGNAL(directoryChanged(QString)),this,SLOT(handleFallbackChange(QString)));
+        connect(fallbackWatcher,SIGNAL(fileChanged(QString)),this,SLOT(handleFallbackChange(QString)));
+    }
+}
+
+bool DirectoryWatcher::matchesFilters(QString name)
+{
+    return QDir::match(scanner.nameFilters, name);
+}
+QSet<QString> DirectoryWatcher::listMatchingFiles() //updates scanner.folders too
+{
+    return scanner.scan().toSet();
+}
+void DirectoryWatcher::watchFolder(QString folder)
+{
+    if(fallbackWatcher != nullptr){
+        fallbackWatcher->addPath(QDir(folderPath).filePath(folder));
+        return;
+    }
+#ifdef Q_OS_LINUX
+    int watch = inotify_add_watch(inotifyFd, QFile::encodeName(QDir(folderPath).filePath(folder)).constData(),
+                                  IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if(watch == -1){
+        qDebug()<<"[DirectoryWatcher::watchFolder]Failed watching:"<<folder;
+    }else{
+        watchedFolders.insert(watch, folder);
+    }
+#else
+    Q_UNUSED(folder);
+#endif
+}
+void DirectoryWatcher::handleFolderAdded(QString folder) //created or moved in, maybe with files already
+{
+    FolderScanner subScanner(QDir(folderPath).filePath(folder), scanner.nameFilters, scanner.skippedFolders);
+    QStringList files = subScanner.scan();
+
+    QSet<QString> watched = scanner.folders.toSet(); //the watched ones, for inotify and the fallback alike
+    for(QString subfolder: subScanner.folders){
+        QString path = subfolder.isEmpty() ? folder : folder + "/" + subfolder;
+        if(watched.contains(path)) continue;
+        watchFolder(path);
+        scanner.folders.push_back(path);
+    }
+    for(QString file: files) pendingNames.insert(folder + "/" + file);
+}
+void DirectoryWatcher::handleFolderRemoved(QString folder) //deleted or moved out, with its files
+{
+    QString prefix = folder + "/";
+    for(QString name: knownFiles){
+        if(name.startsWith(prefix)) pendingNames.insert(name);
+    }
+    for(QString watched: QStringList(scanner.folders)){
+        if( (watched == folder) | watched.startsWith(prefix) ){
+            scanner.folders.removeOne(watched);
+            if(fallbackWatcher != nullptr) fallbackWatcher->removePath(QDir(folderPath).filePath(watched));
+        }
+    }
+#ifdef Q_OS_LINUX
+    //A moved folder keeps its watch, it's not ours anymore
+    for(int watch: watchedFolders.keys()){
+        QString watched = watchedFolders.value(watch);
+        if( (watched == folder) | watched.startsWith(prefix) ){
+            inotify_rm_watch(inotifyFd, watch);
+            watchedFolders.remove(watch);
+        }
+    }
+#endif
+}
+
+void DirectoryWatcher::readInotifyEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(inotify_event) char buffer[4096];
+
+    while(true){
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        if(length <= 0) break;
+
+        for(char *ptr = buffer; ptr < buffer + length; ){
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(ptr);
+
+            if(event->mask & IN_Q_OVERFLOW){ //events were lost, check every file
+                pendingNames.unite(knownFiles);
+                pendingNames.unite(listMatchingFiles());
+                QSet<QString> watched = watchedFolders.values().toSet();
+                for(QString folder: scanner.folders){
+                    if(!watched.contains(folder)) watchFolder(folder);
+                }
+            }else if( (event->len > 0) && watchedFolders.contains(event->wd) ){
+                QString name = QFile::decodeName(event->name);
+                QString folder = watchedFolders.value(event->wd);
+                QString path = folder.isEmpty() ? name : folder + "/" + name;
+
+                bool isSkippedFolder = QDir::match(scanner.skippedFolders, name); //.tiles, .misli_history..
+
+                if( (event->mask & IN_ISDIR) && !isSkippedFolder ){
+                    if(event->mask & (IN_CREATE | IN_MOVED_TO)) handleFolderAdded(path);
+                    if(event->mask & (IN_DELETE | IN_MOVED_FROM)) handleFolderRemoved(path);
+                }else if( !(event->mask & IN_ISDIR) && matchesFilters(name) ){
+                    pendingNames.insert(path);
+                }
+            }
+            if(event->mask & IN_IGNORED) watchedFolders.remove(event->wd); //the folder is gone
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    if(!pendingNames.isEmpty()) scheduleFlush();
+#endif
+}
+void DirectoryWatcher::rescanFolder(QString folder) //for the fallback watcher: only the files and subfolders right in it
+{
+    FolderScanner::Listing listing;
+    listing.folder = folder;
+    scanner.listFolder(listing);
+    QString prefix = folder.isEmpty() ? QString() : folder + "/";
+
+    QSet<QString> currentFiles = listing.files.toSet(), knownHere;
+    for(QString name: knownFiles){
+        if(name.startsWith(prefix) && !name.mid(prefix.size()).contains('/')) knownHere.insert(name);
+    }
+    pendingNames.unite(currentFiles - knownHere);
+    pendingNames.unite(knownHere - currentFiles);
+
+    QSet<QString> currentSubfolders = listing.subfolders.toSet(), watchedSubfolders;
+    for(QString watched: scanner.folders){
+        if(!watched.isEmpty() && watched.startsWith(prefix) && !watched.mid(prefix.size()).contains('/')) watchedSubfolders.insert(watched);
+    }
+    for(QString subfolder: currentSubfolders - watchedSubfolders) handleFolderAdded(subfolder);
+    for(QString subfolder: watchedSubfolders - currentSubfolders) handleFolderRemoved(subfolder);
+}
+void DirectoryWatcher::handleFallbackChange(QString path)
+{
+    QString name = QDir(folderPath).relativeFilePath(path);
+    if(name == ".") name.clear(); //the top folder
+
+    if(QFileInfo(path).isDir()){ //a file or a subfolder was added or removed in it
+        rescanFolder(name);
+    }else if(QFileInfo(path).exists() | knownFiles.contains(name)){ //a removed folder comes with a change of its parent
+        pendingNames.insert(name);
+    }
+    scheduleFlush();
+}
+void DirectoryWatcher::scheduleFlush() //after a quiet period, but no later than DIRECTORY_WATCH_MAX_LATENCY after the first event
+{
+    if(!debounceTimer.isActive()) pendingSince.start();
+
+    qint64 remaining = DIRECTORY_WATCH_MAX_LATENCY - pendingSince.elapsed();
+    debounceTimer.start(int(qBound(qint64(0), remaining, qint64(DIRECTORY_WATCH_DEBOUNCE))));
+}
+void DirectoryWatcher::flushPendingChanges()
+{
+    QDir dir(folderPath);
+    QSet<QString> names;
+    names.swap(pendingNames);
+
+    //Only the end result of the burst counts
+    for(QString name: names){
+        QString filePath = dir.filePath(name);
+        bool exists = QFileInfo(filePath).isFile();
+
+        if(exists && !knownFiles.contains(name)){
+            knownFiles.insert(name);
+            if(fallbackWatcher != nullptr) fallbackWatcher->addPath(filePath);
+            emit fileAdded(filePath);
+        }else if(exists){
+            //A replaced file drops off the fallback watcher
+            if( (fallbackWatcher != nullptr) && !fallbackWatcher->files().contains(filePath) ) fallbackWatcher->addPath(filePath);
+            emit fileChanged(filePath);
+        }else if(knownFiles.contains(name)){
+            knownFiles.remove(name);
+            emit fileRemoved(filePath);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DIRECTORYWATCHER_H
+#define DIRECTORYWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "folderscanner.h"
+
+class QSocketNotifier;
+class QFileSystemWatcher;
+
+//Watches the files in a folder and its subfolders that match the name
+//filters. On Linux it's one inotify watch per folder (no per-file watches).
+//The events for a file are collected until it's quiet for a while, so a sync
+//tool's delete + create + write comes out as one added, changed or removed
+//signal. Nothing is watched until startWatching() gets a scan of the folder.
+class DirectoryWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    //Functions
+    DirectoryWatcher(QString folderPath, QStringList nameFilters, QStringList skippedFolders, QObject *parent = nullptr);
+    ~DirectoryWatcher();
+    void startWatching(QStringList filePaths, QStringList folders);
+
+    //Variables
+    QString folderPath;
+    FolderScanner scanner;
+    QSet<QString> knownFiles; //paths of the matching files (relative to the folder), as of the last flush
+    QSet<QString> pendingNames; //with events since the last flush
+    bool isWatching;
+    QTimer debounceTimer;
+    QElapsedTimer pendingSince; //the first event since the last flush
+    int inotifyFd;
+    QHash<int, QString> watchedFolders; //inotify watch -> relative folder path
+    QSocketNotifier *inotifyNotifier;
+    QFileSystemWatcher *fallbackWatcher; //where inotify isn't available
+
+signals:
+    void fileAdded(QString filePath);
+    void fileChanged(QString filePath);
+    void fileRemoved(QString filePath);
+
+private slots:
+    void readInotifyEvents();
+    void handleFallbackChange(QString path);
+    void flushPendingChanges();
+
+private:
+    bool matchesFilters(QString name);
+    QSet<QString> listMatchingFiles();
+    void watchFolder(QString folder);
+    void rescanFolder(QString folder);
+    void scheduleFlush();
+    void handleFolderAdded(QString folder);
+    void handleFolderRemoved(QString folder);
+};
+
+#endif // DIRECTORYWATCHER_H
@@ -0,0 +1,71 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDir>
+#include <QtConcurrent/QtConcurrent>
+
+#include "folderscanner.h"
+
+FolderScanner::FolderScanner(QString folderPath_, QStringList nameFilters_, QStringList skippedFolders_)
+{
+    folderPath = folderPath_;
+    nameFilters = nameFilters_;
+    skippedFolders = skippedFolders_;
+}
+
+void FolderScanner::listFolder(Listing &listing) //safe to call from the thread pool
+{
+    QDir dir(QDir(folderPath).filePath(listing.folder));
+    QString prefix = listing.folder.isEmpty() ? QString() : listing.folder + "/";
+
+    for(QString fileName: dir.entryList(nameFilters, QDir::Files)){
+        listing.files.push_back(prefix + fileName);
+    }
+    //No symlinks, they could make a loop
+    for(QString subfolder: dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks)){
+        if(!QDir::match(skippedFolders, subfolder)) listing.subfolders.push_back(prefix + subfolder);
+    }
+}
+QStringList FolderScanner::scan(ProgressCallback progress)
+{
+    QStringList files;
+    QStringList level = QStringList()<<"";
+    folders.clear();
+
+    //Breadth first, one depth at a time
+    while(!level.isEmpty()){
+        QList<Listing> listings;
+        for(QString folder: level){
+            Listing listing;
+            listing.folder = folder;
+            listings.push_back(listing);
+        }
+        QtConcurrent::blockingMap(listings, [this](Listing &listing){
+            listFolder(listing);
+        });
+        folders.append(level);
+
+        QStringList nextLevel;
+        for(const Listing &listing: listings){
+            files.append(listing.files);
+            nextLevel.append(listing.subfolders);
+        }
+        level = nextLevel;
+
+        if(progress) progress(folders.size(), files.size());
+    }
+    return files;
+}
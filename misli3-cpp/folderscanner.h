@@ -0,0 +1,50 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FOLDERSCANNER_H
+#define FOLDERSCANNER_H
+
+#include <functional>
+
+#include <QStringList>
+
+//Lists the files matching the name filters in a folder and its subfolders.
+//The folders of each depth are listed in parallel on the thread pool, so a
+//big tree isn't walked one stat call at a time. The paths are relative to
+//the scanned folder, with '/' separators.
+class FolderScanner
+{
+public:
+    typedef std::function<void(int foldersScanned, int filesFound)> ProgressCallback;
+    struct Listing{
+        QString folder;
+        QStringList files, subfolders;
+    };
+
+    //Functions
+    FolderScanner(QString folderPath, QStringList nameFilters, QStringList skippedFolders);
+
+    QStringList scan(ProgressCallback progress = nullptr);
+    void listFolder(Listing &listing); //only that folder, without its subfolders
+
+    //Variables
+    QString folderPath;
+    QStringList nameFilters;
+    QStringList skippedFolders; //wildcards for the subfolder names to leave out
+    QStringList folders; //as of the last scan, "" for the top one
+};
+
+#endif // FOLDERSCANNER_H
@@ -24,7 +24,8 @@
 #define CLICK_RADIUS 0.3
 #define MOVE_SPEED 3
 #define MOVE_FUNC_TIMEOUT 300 //milisecs to hold the mouse on a note to move it
-#define MAX_UNDO_STEPS 100 //should be memory consumption based
+#define UNDO_HISTORY_BUDGET 50000000 //bytes, for the undo/redo history of all the notefiles together
+#define UNDO_PERSIST_DELAY 500 //ms after the last undo/redo before the notefile gets written
 #define INITIAL_EYE_Z 90 //default height of the viewpoint
 #define NOTE_SPACING 0.2
 #define RESIZE_CIRCLE_RADIUS 1
@@ -41,6 +42,22 @@
 #define MAX_FONT_SIZE 100
 #define MAX_URI_LENGTH 2048
 #define TIME_FORMAT "d.M.yyyy H:m:s"
+#define DIRECTORY_WATCH_DEBOUNCE 300 //ms without events before a file's changes are handled (sync tools come in bursts)
+#define DIRECTORY_WATCH_MAX_LATENCY 3000 //ms from the first pending event, for files that keep being written
+#define REMOVED_NOTEFILE_GRACE 2000 //ms a removed notefile is kept, in case a sync tool is replacing it
+#define MERGE_CONFLICT_TAG "merge_conflict" //on the copies of notes edited both here and on a synced machine
+#define LIBRARY_SKIPPED_FOLDERS {".*", "*.tiles"} //subfolders of a library that aren't scanned for notefiles
+#define INSTANCE_SERVER_TIMEOUT 1000 //ms for the running instance to take a later launch's commands
+#define SEARCH_SHOWN_RESULTS 200 //rows shown in the search list
+#define SEARCH_RESULTS_BATCH 100 //results sent to the GUI at once while a search runs
+#define SEARCH_CACHED_QUERIES 8 //results kept for refining the search while typing
+#define NOTEFILE_HEADER_PEEK_SIZE 256 //bytes read to get the notefile flags without parsing the notes
+#define PAGED_NOTEFILE_MIN_SIZE 10000000 //bytes, bigger notefiles get converted to the paged layout
+#define PAGED_NOTEFILE_MIN_NOTES 20000 //same for the note count
+#define PAGED_TILE_SIZE 200 //in canvas units
+#define PAGED_TILES_MARGIN 1 //tiles loaded around the visible ones (one more is kept before evicting)
+#define PAGED_MAX_RESIDENT_TILES 400 //when zoomed out further, only the tiles around the center are loaded
+#define PAGED_TILES_LOAD_BUDGET 8 //ms of tile loading per pass, the rest is loaded on the next one
 
 const qint64 days = 24*60*60*1000;
 const qint64 months = 30*days;
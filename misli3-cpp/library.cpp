@@ -15,9 +15,13 @@
 */
 
 #include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QtConcurrent/QtConcurrent>
 
 #include "global.h"
 #include "library.h"
+#include "memoryusage.h"
 #include "misli_desktop/misliwindow.h"
 #include "misli_desktop/mislidesktopgui.h"
 
@@ -25,20 +29,9 @@ Library::Library(QString storageLocation, bool enableFSWatch)
 {
     fsWatchIsEnabled = enableFSWatch;
 
-    //FS-watch stuff
-    if(fsWatchIsEnabled){
-        fs_watch = new QFileSystemWatcher(this);
-        connect(fs_watch,SIGNAL(fileChanged(QString)),this,SLOT(handleChangedFile(QString)) );
-
-        hangingNfCheck = new QTimer;
-        connect(hangingNfCheck,SIGNAL(timeout()),this,SLOT(checkForHangingNFs() ));
-    }else{
-        fs_watch = nullptr;
-        hangingNfCheck = nullptr;
-    }
-
     //Connect propery changes
-    connect(this,SIGNAL(noteFilesChanged()),this,SLOT(reinitNotesPointingToNotefiles()));
+    connect(&scanningWatcher,SIGNAL(finished()),this,SLOT(handleBackgroundScanFinished()));
+    connect(&headersReadingWatcher,SIGNAL(finished()),this,SLOT(handleBackgroundHeadersRead()));
 
     //Setup
     QDir newDir(storageLocation);
@@ -53,57 +46,71 @@ Library::Library(QString storageLocation, bool enableFSWatch)
     }
 
     folderPath = storageLocation;
-    loadNoteFiles();
-
-    // Load the hacky tags note if it exists somewhere
-    for (auto nf: noteFiles_m){
-        for(auto nt: nf->notes){
-            if(nt->text().startsWith("define_filter_menu_tags:")){
-                auto lines = nt->text().split("\n", QString::SkipEmptyParts);
-                lines.pop_front(); // The "define_filter_menu_tags:"
-                filter_menu_tags = lines;
-            }
+
+    //Optional SQLite backend, the .json files are imported once, on its first use
+    if(settings.value("sqlite_storage", false).toBool()){
+        sqlStorage = new SqlStorage(QDir(folderPath).filePath(".misli_library.sqlite"));
+        if(!sqlStorage->open()){
+            delete sqlStorage;
+            sqlStorage = nullptr;
+        }else if(sqlStorage->metaValue("json_imported").isEmpty()){
+            if(sqlStorage->noteFileNames().isEmpty()) sqlStorage->importJsonFolder(folderPath);
+            else sqlStorage->setMetaValue("json_imported", "1"); //imported before the flag was kept
         }
     }
+
+    //FS-watch stuff (there are no files to watch with the database)
+    if(sqlStorage != nullptr) fsWatchIsEnabled = false;
+    if(fsWatchIsEnabled){
+        dirWatcher = new DirectoryWatcher(folderPath, QStringList()<<"*.json", LIBRARY_SKIPPED_FOLDERS, this);
+        connect(dirWatcher,SIGNAL(fileChanged(QString)),this,SLOT(handleChangedFile(QString)));
+        connect(dirWatcher,SIGNAL(fileAdded(QString)),this,SLOT(handleAddedFile(QString)));
+        connect(dirWatcher,SIGNAL(fileRemoved(QString)),this,SLOT(handleRemovedFile(QString)));
+    }
+
+    if(sqlStorage == nullptr){ //the database is indexed already
+        cache = new LibraryCache(QDir(folderPath).filePath(".misli_library_cache"));
+        cache->load();
+    }
+
+    versionStore = new VersionStore(QDir(folderPath).filePath(".misli_history"));
+    if(!versionStore->open()){
+        delete versionStore;
+        versionStore = nullptr;
+    }
+
+    loadDefaultNoteFile();
 }
 Library::~Library()
 {
+    //Let the background loading finish, the thread pool may be using the notefiles
+    scanning.waitForFinished();
+    headersReading.waitForFinished();
+    backgroundParsing.cancel();
+    backgroundParsing.waitForFinished();
+
+    for(NoteFile *nf: noteFiles_m) nf->flushPendingWrite(); //after undo/redo
+
+    if(cache != nullptr){
+        cache->save(noteFiles_m);
+        delete cache;
+    }
     unloadAllNoteFiles();
-    delete fs_watch;
-    delete hangingNfCheck;
+    if(versionStore != nullptr){
+        versionStore->pruneIfDue();
+        delete versionStore;
+    }
+    delete dirWatcher;
+    delete sqlStorage;
 }
 QList<NoteFile*> Library::noteFiles()
 {
     return noteFiles_m;
 }
 
-void Library::checkForHangingNFs()
-{
-    int missingNfCount=0;
-
-    for(NoteFile * nf: noteFiles_m){
-        if(!nf->isReadable){
-            //Try to init
-            if( nf->loadFromFilePath() == 0 ){ //File is found and initialized properly
-                nf->isReadable = true;
-                //qDebug()<<"Adding path to fs_watch: "<<nf->filePath_m;
-                fs_watch->addPath(nf->filePath()); //when a file is deleted it gets off the fs_watch and we need to re-add it when a unix-type file save takes place
-            }else{
-                missingNfCount++;
-            }
-        }
-    }
-    if(missingNfCount==0) hangingNfCheck->stop(); //if none are missing - stop checking
-}
-
 NoteFile * Library::noteFileByName(QString name)
 {
-    for(NoteFile *nf: noteFiles_m){
-        if(nf->name()==name){
-            return nf;
-        }
-    }
-    return nullptr;
+    return noteFilesByName.value(name, nullptr);
 }
 
 NoteFile * Library::defaultNoteFile()
@@ -127,14 +134,23 @@ int Library::makeCanvas(QString name)
     }
 
     QString filePath = QDir(folderPath).filePath(name + ".json");
-    QFile ntFile(filePath);
 
-    if(!ntFile.open(QIODevice::WriteOnly)){ //Creates the NF
-        qDebug()<<"Error making new notes file";
-        return -1;
-    }
+    if(sqlStorage != nullptr){
+        if(!sqlStorage->addNoteFile(name)){
+            qDebug()<<"Error making new notes file";
+            return -1;
+        }
+    }else{
+        QFile ntFile(filePath);
 
-    ntFile.close();
+        QDir().mkpath(QFileInfo(filePath).absolutePath()); //"folder/name" makes the subfolder
+        if(!ntFile.open(QIODevice::WriteOnly)){ //Creates the NF
+            qDebug()<<"Error making new notes file";
+            return -1;
+        }
+
+        ntFile.close();
+    }
 
     loadNoteFile(filePath);
 
@@ -143,9 +159,25 @@ int Library::makeCanvas(QString name)
 
 void Library::unloadNoteFile(NoteFile* nf)
 {
-    if(fsWatchIsEnabled) fs_watch->removePath(nf->filePath());
+    //Taken out of the background parsing. If it's being parsed right now, only that is waited for
+    if(isLoadingInBackground){
+        QMutexLocker unloadedLocker(&unloadedInBackgroundMutex);
+        unloadedInBackground.insert(nf);
+    }
+    nf->parseMutex.lock();
+    nf->parseMutex.unlock();
+    nf->flushPendingWrite();
+
     noteFiles_m.removeOne(nf);
+    if(noteFilesByName.value(nf->name()) == nf) noteFilesByName.remove(nf->name());
+    emit noteFileAboutToBeUnloaded(nf); //not in the list anymore, but not deleted yet
+    QString name = nf->name();
     delete nf;
+    graph.removeNoteFile(name);
+    if(tagIndex.removeNoteFile(name)) emit tagsChanged();
+    timeIndex.removeNoteFile(name);
+    textIndex.removeNoteFile(name);
+    checkRedirectsTo(name);
     emit noteFilesChanged();
 }
 
@@ -153,10 +185,211 @@ void Library::loadNoteFiles()
 {
     unloadAllNoteFiles();
 
+    convertLegacyNoteFiles();
+
+    QStringList folders;
+    QStringList filePaths = noteFilePaths(&folders);
+    if(dirWatcher != nullptr) dirWatcher->startWatching(filePaths, folders);
+
+    for(QString filePath: filePaths){
+        loadNoteFile(filePath);
+    }
+}
+QStringList Library::noteFilePaths(QStringList *folders) //of all the notefiles, loaded or not. Safe to call from the thread pool
+{
+    QDir dir(folderPath);
+    QStringList paths;
+
+    if(sqlStorage != nullptr){ //there are no files, the path just gives the name
+        for(QString name: sqlStorage->noteFileNames()) paths.push_back(dir.filePath(name + ".json"));
+    }else{ //the subfolders too, the names are the relative paths
+        FolderScanner scanner(folderPath, QStringList()<<"*.json", LIBRARY_SKIPPED_FOLDERS);
+        QStringList fileNames = scanner.scan([this](int foldersScanned, int filesFound){
+            emit scanningProgress(foldersScanned, filesFound);
+        });
+        for(QString fileName: fileNames) paths.push_back(dir.absoluteFilePath(fileName));
+        if(folders != nullptr) *folders = scanner.folders;
+    }
+    return paths;
+}
+QJsonObject Library::memoryUsage() //estimated bytes per notefile and for the library-wide indexes
+{
+    QJsonArray noteFilesUsage;
+    qint64 noteFilesBytes = 0;
+    for(NoteFile *nf: noteFiles_m){
+        QJsonObject usage = nf->memoryUsage();
+        noteFilesBytes += qint64(usage["total"].toDouble());
+        noteFilesUsage.append(usage);
+    }
+
+    qint64 redirectBytes = memorySize(redirectsByTarget) + memorySize(redirectTargetOfNote);
+    for(const QSet<Note*> &redirects: redirectsByTarget) redirectBytes += redirects.size() * qint64(3 * sizeof(void*));
+
+    qint64 cacheBytes = 0;
+    if(cache != nullptr){
+        cacheBytes = memorySize(cache->entries);
+        for(const LibraryCache::Entry &entry: cache->entries){
+            cacheBytes += memorySize(entry.hash) + memorySize(entry.redirectTargets) + memorySize(entry.tags);
+        }
+    }
+
+    qint64 indexBytes = memorySize(noteFilesByName) + redirectBytes + graph.memoryUsage() + tagIndex.memoryUsage() + timeIndex.memoryUsage() + textIndex.memoryUsage();
+
+    QJsonObject usage;
+    usage["folder"] = folderPath;
+    usage["notefiles"] = noteFilesUsage;
+    usage["notefiles_total"] = noteFilesBytes;
+    usage["name_index"] = memorySize(noteFilesByName);
+    usage["redirect_index"] = redirectBytes;
+    usage["link_graph"] = graph.memoryUsage();
+    usage["tag_index"] = tagIndex.memoryUsage();
+    usage["time_index"] = timeIndex.memoryUsage();
+    usage["text_index"] = textIndex.memoryUsage();
+    usage["library_cache"] = cacheBytes; //the mapped file is left to the OS
+    usage["total"] = noteFilesBytes + indexBytes + cacheBytes;
+    return usage;
+}
+QString Library::noteFileNameForPath(QString filePath) //the inverse of the paths above
+{
+    QString name = QDir(folderPath).relativeFilePath(filePath);
+    name.chop(5); //.json or .misl
+    return name;
+}
+void Library::loadDefaultNoteFile() //only the notefile shown on startup, the rest come from loadNoteFilesInBackground()
+{
+    QDir dir(folderPath);
+
+    //The cache knows which notefile has the flag, so the others don't have to be opened
+    if(cache != nullptr){
+        for(auto entry = cache->entries.constBegin(); entry != cache->entries.constEnd(); ++entry){
+            if(entry->isDisplayedFirstOnStartup){
+                loadNoteFile(dir.filePath(entry.key() + ".json"));
+                break;
+            }
+        }
+    }
+    if( (defaultNoteFile() != nullptr) && defaultNoteFile()->isDisplayedFirstOnStartup ) return;
+
+    //No valid cache - peek at the headers until the flagged notefile is found
+    unloadAllNoteFiles();
+
+    NoteFile *firstNf = nullptr, *defaultNf = nullptr;
+    for(QString filePath: noteFilePaths()){
+        NoteFile *nf = makeNoteFile(filePath);
+
+        if( (readNoteFileHeader(nf) != 0) | nf->name().isEmpty() ){
+            delete nf;
+        }else if(nf->isDisplayedFirstOnStartup){
+            defaultNf = nf;
+            break;
+        }else if(firstNf == nullptr){
+            firstNf = nf; //in case none is flagged
+        }else{
+            delete nf;
+        }
+    }
+
+    if(defaultNf != nullptr){
+        delete firstNf;
+        addNoteFile(defaultNf);
+    }else if(firstNf != nullptr){
+        addNoteFile(firstNf);
+    }
+    emit noteFilesChanged();
+}
+void Library::loadNoteFilesInBackground()
+{
+    if( folderPath.isEmpty() | isLoadingInBackground ) return;
+
+    isLoadingInBackground = true;
+    convertLegacyNoteFiles();
+
+    //Walking the folders goes to the thread pool too
+    scanning = QtConcurrent::run([this](){
+        return noteFilePaths(&scannedFolders);
+    });
+    scanningWatcher.setFuture(scanning);
+}
+void Library::handleBackgroundScanFinished()
+{
+    //The NoteFile objects are made here, only the file reading goes to the thread pool
+    backgroundNoteFiles.clear();
+    for(QString filePath: scanning.result()){
+        if(noteFileByName(noteFileNameForPath(filePath)) != nullptr) continue; //already loaded
+
+        backgroundNoteFiles.push_back(makeNoteFile(filePath));
+    }
+
+    emit loadingProgress(0, backgroundNoteFiles.size());
+
+    headersReading = QtConcurrent::map(backgroundNoteFiles, [this](NoteFile *nf){
+        readNoteFileHeader(nf);
+    });
+    headersReadingWatcher.setFuture(headersReading);
+}
+void Library::handleBackgroundHeadersRead()
+{
+    QList<NoteFile*> nfsToParse;
+
+    //Add all the readable notefiles at once, so the menu and the redirects get updated once
+    for(NoteFile *nf: backgroundNoteFiles){
+        if( !nf->isReadable | nf->name().isEmpty() ){
+            qDebug()<<"[Library::handleBackgroundHeadersRead]Note file is not readable, skipping: " << nf->filePath();
+            delete nf;
+        }else if(noteFileByName(nf->name()) != nullptr){ //loaded while the headers were read (e.g. made or reported by the watcher)
+            delete nf;
+        }else{
+            addNoteFile(nf);
+            if(!nf->isLoaded) nfsToParse.push_back(nf);
+        }
+    }
+    backgroundNoteFiles = nfsToParse; //the sequence has to outlive the map
+    emit noteFilesChanged();
+
+    //The directory watcher starts from the same walk of the folders, once its notefiles are in
+    if(dirWatcher != nullptr) dirWatcher->startWatching(scanning.result(), scannedFolders);
+
+    //Parse the notes. Each notefile is attached on the GUI thread as soon as it's ready
+    backgroundLoadingTotal = nfsToParse.size();
+    backgroundLoadingDone = 0;
+    emit loadingProgress(0, backgroundLoadingTotal);
+    if(backgroundLoadingTotal == 0){
+        isLoadingInBackground = false;
+        emit loadingFinished();
+        return;
+    }
+
+    backgroundParsing = QtConcurrent::map(backgroundNoteFiles, [this](NoteFile *nf){
+        QMutexLocker unloadedLocker(&unloadedInBackgroundMutex);
+        if(!unloadedInBackground.contains(nf)){
+            QMutexLocker parseLocker(&nf->parseMutex); //unloadNoteFile() waits for it from here on
+            unloadedLocker.unlock();
+            nf->parseIfNotLoaded();
+        }
+        QMetaObject::invokeMethod(this, "attachNoteFileParsedInBackground", Qt::QueuedConnection, Q_ARG(NoteFile*, nf));
+    });
+}
+void Library::attachNoteFileParsedInBackground(NoteFile *nf)
+{
+    //The notefile may have been opened (or removed) in the meantime. Only this thread adds to unloadedInBackground
+    if(!unloadedInBackground.contains(nf) && noteFiles_m.contains(nf) && !nf->isLoaded) nf->finishLoading();
+
+    backgroundLoadingDone++;
+    emit loadingProgress(backgroundLoadingDone, backgroundLoadingTotal);
+    if(backgroundLoadingDone == backgroundLoadingTotal){
+        isLoadingInBackground = false;
+        QMutexLocker unloadedLocker(&unloadedInBackgroundMutex);
+        unloadedInBackground.clear(); //the pool is done with them
+        unloadedLocker.unlock();
+        emit loadingFinished();
+    }
+}
+void Library::convertLegacyNoteFiles()
+{
     QDir dir(folderPath);
 
     QStringList nfs_misl = dir.entryList(QStringList()<<"*.misl", QDir::Files);
-    QStringList nfs_json = dir.entryList(QStringList()<<"*.json", QDir::Files);
+    if(nfs_misl.isEmpty()) return;
 
     // First load any .misl (legacy) note files and backup + convert them
     for(QString fileName: nfs_misl){
@@ -170,50 +403,128 @@ void Library::loadNoteFiles()
         }
         QFile::copy(oldPath, backupPath);
 
-        //load nf
+        //load nf (the conversion needs the notes parsed)
         loadNoteFile(oldPath);
     }
+    parseAllNoteFiles();
 
     //Rename all misl to json
     for(NoteFile *nf: noteFiles()){
+        if(!nf->filePath().endsWith(".misl")) continue;
+
         QString newName = nf->filePath();
         newName.chop(5);
         newName = newName + ".json";
         renameNoteFile(nf, newName);
     }
+}
+void Library::parseAllNoteFiles()
+{
+    parseNoteFiles(noteFiles_m);
+}
+void Library::parseNoteFiles(QList<NoteFile*> nfs)
+{
+    QList<NoteFile*> nfsToLoad;
 
-    for(QString fileName: nfs_json){
-        loadNoteFile(dir.absoluteFilePath(fileName));
+    for(NoteFile *nf: nfs){
+        if(!nf->isLoaded) nfsToLoad.push_back(nf);
+    }
+
+    //The ones the background loading got to are not parsed again
+    QtConcurrent::blockingMap(nfsToLoad, [](NoteFile *nf){
+        nf->parseIfNotLoaded();
+    });
+
+    //Attaching the notes, connecting them and the loaded() handling stay on the GUI thread
+    for(NoteFile *nf: nfsToLoad){
+        nf->finishLoading();
     }
 }
-void Library::reinitNotesPointingToNotefiles()
+void Library::reinitNotesPointingToNotefiles() //all the redirecting notes, from the index
 {
-    for(NoteFile *nf: noteFiles_m){
-        for(Note *nt: nf->notes){
-            if(nt->type==NoteType::redirecting) nt->checkTextForNoteFileLink();
-        }
+    for(auto target = redirectsByTarget.constBegin(); target != redirectsByTarget.constEnd(); ++target){
+        for(Note *nt: target.value()) checkRedirectTarget(nt);
     }
 }
+void Library::checkRedirectsTo(QString name) //after the notefile with that name was added or removed
+{
+    for(Note *nt: redirectsByTarget.value(name)) checkRedirectTarget(nt);
+}
+void Library::checkRedirectTarget(Note *nt) //here and not on paint, the targets change only with the notefiles
+{
+    nt->textForShortening = (noteFileByName(nt->redirectTarget) != nullptr) ? nt->redirectTarget : tr("Missing note file");
+}
+void Library::indexRedirect(Note *nt) //on Note::checkTextForNoteFileLink()
+{
+    QString oldTarget = redirectTargetOfNote.value(nt);
+    if(!oldTarget.isEmpty()){
+        redirectsByTarget[oldTarget].remove(nt);
+        if(redirectsByTarget[oldTarget].isEmpty()) redirectsByTarget.remove(oldTarget);
+    }
+
+    if(nt->redirectTarget.isEmpty()){
+        redirectTargetOfNote.remove(nt);
+        disconnect(nt, &QObject::destroyed, this, &Library::unindexRedirect);
+        return;
+    }
+
+    if(oldTarget.isEmpty()) connect(nt, &QObject::destroyed, this, &Library::unindexRedirect);
+    redirectTargetOfNote.insert(nt, nt->redirectTarget);
+    redirectsByTarget[nt->redirectTarget].insert(nt);
+    checkRedirectTarget(nt);
+}
+void Library::unindexRedirect(QObject *nt) //the note is being deleted, only the pointer is used
+{
+    QString target = redirectTargetOfNote.take(nt);
+    redirectsByTarget[target].remove(static_cast<Note*>(nt));
+    if(redirectsByTarget[target].isEmpty()) redirectsByTarget.remove(target);
+}
 
 void Library::handleChangedFile(QString filePath)
 {
     int err=0;
 
-    NoteFile *nf,dummyNF;
-
-    dummyNF.filePath_m = filePath; //Get the name
-    nf = noteFileByName(dummyNF.name()); //Locate the nf whith that name
+    NoteFile *nf = noteFileByName(noteFileNameForPath(filePath)); //Locate the nf whith that name
 
     if(nf==nullptr) return;//avoid segfaults on a wrong name
 
-    if( nf->loadFromFilePath()==0 ){
-        nf->isReadable = true;
-    }else if(err ==-2){ //most times the file is deleted and then replaced on sync , so we need to check back for it later
-        nf->isReadable=false;
-        hangingNfCheck->start(700);
-    }
+    //Skip the events for our own writes and for rewrites of the same contents (sync tools)
+    if(nf->isUnchangedOnDisk()) return;
+
+    //Notefiles that haven't been opened only need their header refreshed
+    err = nf->isLoaded ? nf->reloadFromFilePath() : nf->readHeader();
+
+    //If it's missing, the watcher reports it again when it comes back
+    nf->isReadable = (err == 0);
     emit noteFilesChanged();
 }
+void Library::handleAddedFile(QString filePath)
+{
+    if(noteFileByName(noteFileNameForPath(filePath)) != nullptr){ //ours (new or renamed), or it came back
+        handleChangedFile(filePath);
+        return;
+    }
+    loadNoteFile(filePath);
+}
+void Library::handleRemovedFile(QString filePath)
+{
+    NoteFile *nf = noteFileByName(noteFileNameForPath(filePath));
+    if( (nf == nullptr) || (nf->filePath() != filePath) ) return; //unloaded already, or renamed
+
+    //A sync tool may be replacing it. If it comes back, the notefile stays with its history
+    QString name = nf->name();
+    QTimer::singleShot(REMOVED_NOTEFILE_GRACE, this, [this, name, filePath](){
+        NoteFile *removedNf = noteFileByName(name);
+        if( (removedNf == nullptr) || (removedNf->filePath() != filePath) || QFile::exists(filePath) ) return;
+
+        //A pending write of ours brings it back, instead of being dropped
+        if(removedNf->persistTimer.isActive()){
+            removedNf->flushPendingWrite();
+            return;
+        }
+        unloadNoteFile(removedNf);
+    });
+}
 
 void Library::unloadAllNoteFiles()
 {
@@ -232,36 +543,100 @@ void Library::setDefaultEyeZ(double value)
     settings.sync();
 }
 
-void Library::loadNoteFile(QString pathToNoteFile)
+void Library::loadNoteFile(QString pathToNoteFile) //Only the header is read, the notes get parsed on first access
 {
-    NoteFile *nf = new NoteFile;
+    if(noteFileByName(noteFileNameForPath(pathToNoteFile)) != nullptr) return; //already loaded
 
-    nf->saveWithRequest = true;
-    nf->eyeZ = defaultEyeZ();
-    nf->setPathAndLoad(pathToNoteFile);
+    NoteFile *nf = makeNoteFile(pathToNoteFile);
 
     //If the file didn't init correctly - don't add it
-    if(!nf->isReadable | nf->name().isEmpty() ){
+    if( (readNoteFileHeader(nf) != 0) | nf->name().isEmpty() ){
         qDebug()<<"[Library::addNoteFile]Note file is not readable, skipping: " << pathToNoteFile;
         delete nf;
         return;
     }
 
+    addNoteFile(nf);
+    emit noteFilesChanged();
+}
+NoteFile *Library::makeNoteFile(QString pathToNoteFile) //the header is read separately, see readNoteFileHeader()
+{
+    NoteFile *nf = new NoteFile;
+
+    nf->saveWithRequest = true;
+    nf->eyeZ = defaultEyeZ();
+    nf->libraryFolderPath = folderPath;
+    nf->setFilePath(pathToNoteFile);
+    nf->cache = cache;
+    nf->versionStore = versionStore;
+    nf->sqlStorage = sqlStorage;
+
+    return nf;
+}
+int Library::readNoteFileHeader(NoteFile *nf) //safe to call from the thread pool
+{
+    //The flags of an unchanged notefile are in the cache, no need to open it
+    const LibraryCache::Entry *cacheEntry = nullptr;
+    if(cache != nullptr) cacheEntry = cache->validEntry(nf->name(), nf->filePath());
+
+    if(cacheEntry != nullptr){
+        nf->fileSize = cacheEntry->size;
+        nf->isDisplayedFirstOnStartup = cacheEntry->isDisplayedFirstOnStartup;
+        return 0;
+    }
+    if(sqlStorage != nullptr){ //a row in the database
+        nf->isDisplayedFirstOnStartup = sqlStorage->isDisplayedFirstOnStartup(nf->name());
+        nf->isReadable = true;
+        return 0;
+    }
+    return nf->readHeader();
+}
+void Library::addNoteFile(NoteFile *nf)
+{
     noteFiles_m.push_back(nf);
-    nf->saveStateToHistory(); //should be only a virtual save for ctrl-z
+    noteFilesByName.insert(nf->name(), nf);
 
-    if(fsWatchIsEnabled) fs_watch->addPath(nf->filePath());
     connect(nf,SIGNAL(requestingSave(NoteFile*)),this,SLOT(handleSaveRequest(NoteFile*)));
+    connect(nf,SIGNAL(redirectTargetChanged(Note*)),this,SLOT(indexRedirect(Note*)));
+    connect(nf,SIGNAL(loaded(NoteFile*)),this,SLOT(handleNoteFileLoaded(NoteFile*)));
+    connect(nf,SIGNAL(notesChanged(NoteFile*,QList<int>)),this,SLOT(handleNotesChanged(NoteFile*,QList<int>)));
+    connect(nf,&NoteFile::tileNotesRead,this,&Library::updateIndexes);
+    connect(nf,SIGNAL(mergeConflicts(NoteFile*,int)),this,SIGNAL(mergeConflicts(NoteFile*,int)));
 
-    emit noteFilesChanged();
+    checkRedirectsTo(nf->name());
+}
+
+void Library::handleNoteFileLoaded(NoteFile *nf)
+{
+    for(Note *nt: nf->notes){
+        // Load the hacky tags note if it's in this notefile
+        if(nt->text().startsWith("define_filter_menu_tags:")){
+            auto lines = nt->text().split("\n", QString::SkipEmptyParts);
+            lines.pop_front(); // The "define_filter_menu_tags:"
+            filter_menu_tags = lines;
+            emit filterMenuTagsChanged();
+        }
+    }
+}
+
+void Library::handleNotesChanged(NoteFile *nf, QList<int> ids)
+{
+    //Resolved once for all the indexes (all the ids come after a load)
+    updateIndexes(nf, nf->notesByIds(ids));
+}
+void Library::updateIndexes(NoteFile *nf, QHash<int, Note*> notes) //nullptr for the removed ones
+{
+    graph.updateNotes(nf->name(), notes);
+    if(tagIndex.updateNotes(nf->name(), notes)) emit tagsChanged();
+    timeIndex.updateNotes(nf->name(), notes);
+    textIndex.updateNotes(nf->name(), notes);
 }
 
 void Library::handleSaveRequest(NoteFile *nf)
 {
+    //The change event of our own write is recognized by its contents
     nf->saveWithRequest = false;
-    if(fsWatchIsEnabled) fs_watch->removePath(nf->filePath());
     nf->saveLastInHistoryToFile();
-    if(fsWatchIsEnabled) fs_watch->addPath(nf->filePath());
     nf->saveWithRequest = true;
 }
 
@@ -274,27 +649,56 @@ bool Library::renameNoteFile(NoteFile *nf, QString newName)
     QString newFilePath = QDir(folderPath).filePath(newName + ".json");
     QString oldName = nf->name();
 
-    QFile file(nf->filePath());
+    //The redirecting notes may be in any notefile. Skip the ones the cache shows don't point to this one
+    QList<NoteFile*> nfsToLoad;
+    for(NoteFile *nf2: noteFiles_m){
+        if(nf2->isLoaded) continue;
 
-    if( !file.copy(newFilePath) ){ //Copy to a nf with the new name
-        qDebug() << "Error copying " << file.fileName() << " to " << newFilePath;
-        return false;
+        const LibraryCache::Entry *cacheEntry = nullptr;
+        if(cache != nullptr) cacheEntry = cache->validEntry(nf2->name(), nf2->filePath());
+        if( (cacheEntry == nullptr) || cacheEntry->redirectTargets.contains(oldName) ){
+            nfsToLoad.push_back(nf2);
+        }
     }
-    fs_watch->removePath(nf->filePath());//deal with fs_watch
-    nf->filePath_m = newFilePath;
-    nf->save();
-    nf->setPathAndLoad(nf->filePath());
-    file.remove();
+    parseNoteFiles(nfsToLoad);
 
-    //Now change all the notes that point to this one too
-    for(NoteFile *nf2: noteFiles_m){
-        for(Note *nt: nf2->notes){
-            if(nt->type==NoteType::redirecting){
-                if(nt->textForDisplay_m==oldName){
-                    nt->changeText("this_note_points_to:" + newName);
-                }
+    if(sqlStorage != nullptr){ //only the rows get renamed
+        if(!sqlStorage->renameNoteFile(oldName, newName)) return false;
+        if(versionStore != nullptr) versionStore->renameNoteFile(oldName, newName);
+        nf->setFilePath(newFilePath);
+    }else{
+        QFile file(nf->filePath());
+
+        QDir().mkpath(QFileInfo(newFilePath).absolutePath()); //the name may be in a new subfolder
+        if( !file.copy(newFilePath) ){ //Copy to a nf with the new name
+            qDebug() << "Error copying " << file.fileName() << " to " << newFilePath;
+            return false;
+        }
+        if(nf->isPaged){ //the tiles folder follows the name
+            QString oldTilesPath = nf->tilesFolderPath();
+            QString newTilesPath = QDir(folderPath).filePath(newName + ".tiles");
+            if(!QDir().rename(oldTilesPath, newTilesPath)){
+                qDebug() << "Error renaming " << oldTilesPath << " to " << newTilesPath;
             }
         }
+        if(versionStore != nullptr) versionStore->renameNoteFile(oldName, newName);
+        nf->setFilePath(newFilePath);
+        nf->save();
+        nf->setPathAndLoad(nf->filePath());
+        file.remove();
+    }
+
+    noteFilesByName.remove(oldName);
+    noteFilesByName.insert(newName, nf);
+    graph.renameNoteFile(oldName, newName);
+    tagIndex.renameNoteFile(oldName, newName);
+    timeIndex.renameNoteFile(oldName, newName);
+    textIndex.renameNoteFile(oldName, newName);
+
+    //Now change all the notes that point to this one too (they move in the index as they change)
+    for(Note *nt: redirectsByTarget.value(oldName)){
+        nt->changeText("this_note_points_to:" + newName);
     }
+    checkRedirectsTo(newName);
     return true;
 }
@@ -19,12 +19,21 @@
 
 #include <QTimer>
 #include <QSettings>
-#include <QFileSystemWatcher>
+#include <QFutureWatcher>
 
 #include "util.h"
 #include "util.h"
 
 #include "notefile.h"
+#include "librarycache.h"
+#include "versionstore.h"
+#include "directorywatcher.h"
+#include "folderscanner.h"
+#include "sqlstorage.h"
+#include "librarygraph.h"
+#include "tagindex.h"
+#include "timeindex.h"
+#include "trigramindex.h"
 #include "global.h"
 
 class Library;
@@ -43,6 +52,14 @@ public:
     int makeCanvas(QString);
     void unloadAllNoteFiles();
 
+    NoteFile * makeNoteFile(QString pathToNoteFile);
+    int readNoteFileHeader(NoteFile *nf);
+    void addNoteFile(NoteFile *nf);
+    void convertLegacyNoteFiles();
+    QStringList noteFilePaths(QStringList *folders = nullptr);
+    QString noteFileNameForPath(QString filePath);
+    QJsonObject memoryUsage();
+
     NoteFile * noteFileByName(QString name);
     NoteFile * defaultNoteFile();
 
@@ -52,11 +69,31 @@ public:
 
     //Variables
     QList<NoteFile*> noteFiles_m; //all the notefiles
-    QFileSystemWatcher *fs_watch; //to watch the dir for changes
-    QTimer * hangingNfCheck; //periodical check for unaccounted for note files
+    QHash<QString, NoteFile*> noteFilesByName; //the same, kept in sync on load, unload and rename
+    QHash<QString, QSet<Note*>> redirectsByTarget; //the redirecting notes of the loaded notefiles, by target name
+    QHash<QObject*, QString> redirectTargetOfNote; //the reverse, to update the index when a note changes
+    LibraryGraph graph; //the links and redirects of the loaded notefiles
+    TagIndex tagIndex; //the tags of the loaded notes
+    TimeIndex timeIndex; //the loaded notes by creation and modification time
+    TrigramIndex textIndex; //the texts of the loaded notes, for the search
+    DirectoryWatcher *dirWatcher = nullptr; //to watch the dir for changes
     QString folderPath;
+    LibraryCache *cache = nullptr; //warm-start snapshot of the parsed notefiles
+
+    //Background loading (see loadNoteFilesInBackground())
+    QList<NoteFile*> backgroundNoteFiles; //the ones being read or parsed on the thread pool
+    QFuture<QStringList> scanning;
+    QStringList scannedFolders; //by the background scan, for the directory watcher
+    QFutureWatcher<QStringList> scanningWatcher;
+    QFuture<void> headersReading, backgroundParsing;
+    QFutureWatcher<void> headersReadingWatcher;
+    int backgroundLoadingTotal = 0, backgroundLoadingDone = 0;
+    bool isLoadingInBackground = false; //from loadNoteFilesInBackground() until loadingFinished()
+    QSet<NoteFile*> unloadedInBackground; //skipped by the background parsing, see unloadNoteFile()
+    QMutex unloadedInBackgroundMutex;
     QSettings settings;
-    bool keepHistoryViaGit = false;
+    VersionStore *versionStore = nullptr; //the long term history of the notefiles
+    SqlStorage *sqlStorage = nullptr; //if set, the notes are in a database instead of the .json files
 
     bool debug, fsWatchIsEnabled;
 
@@ -71,6 +108,13 @@ signals:
     //Property chabges
     void defaultEyeZChanged(double);
     void noteFilesChanged();
+    void filterMenuTagsChanged();
+    void tagsChanged(); //in the tag index
+    void scanningProgress(int foldersScanned, int noteFilesFound); //may come from the thread pool
+    void loadingProgress(int done, int total);
+    void loadingFinished();
+    void noteFileAboutToBeUnloaded(NoteFile *nf);
+    void mergeConflicts(NoteFile *nf, int count);
 
 public slots:
     //Set properties
@@ -80,10 +124,25 @@ public slots:
     bool renameNoteFile(NoteFile *nf, QString newName);
     void loadNoteFile(QString pathToNoteFile);
     void loadNoteFiles();
+    void loadDefaultNoteFile();
+    void loadNoteFilesInBackground();
+    void handleBackgroundScanFinished();
+    void handleBackgroundHeadersRead();
+    void attachNoteFileParsedInBackground(NoteFile *nf);
+    void parseAllNoteFiles();
+    void parseNoteFiles(QList<NoteFile*> nfs);
     void reinitNotesPointingToNotefiles();
+    void checkRedirectsTo(QString name);
+    void checkRedirectTarget(Note *nt);
+    void indexRedirect(Note *nt);
+    void unindexRedirect(QObject *nt);
+    void handleNoteFileLoaded(NoteFile *nf);
+    void handleNotesChanged(NoteFile *nf, QList<int> ids);
+    void updateIndexes(NoteFile *nf, QHash<int, Note*> notes);
 
-    void checkForHangingNFs();
     void handleChangedFile(QString filePath);
+    void handleAddedFile(QString filePath);
+    void handleRemovedFile(QString filePath);
 
     void handleSaveRequest(NoteFile *nf);
     void unloadNoteFile(NoteFile *nf);
@@ -0,0 +1,216 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QDateTime>
+
+#include "librarycache.h"
+#include "notefile.h"
+
+static const quint32 cacheMagic = 0x4d534c43; //"MSLC"
+static const quint32 cacheVersion = 1;
+
+LibraryCache::LibraryCache(QString cacheFilePath)
+{
+    filePath = cacheFilePath;
+}
+LibraryCache::~LibraryCache()
+{
+    unmap();
+}
+
+bool LibraryCache::load()
+{
+    unmap();
+    entries.clear();
+
+    file.setFileName(filePath);
+    if(!file.open(QIODevice::ReadOnly)){ //There's no cache on the first start
+        return false;
+    }
+
+    //The whole snapshot is mapped with one read, the notes get deserialized only when a notefile is opened
+    mappedData = file.map(0, file.size());
+    if(mappedData == nullptr){
+        qDebug()<<"[LibraryCache::load]Failed mapping the cache file:"<<filePath;
+        file.close();
+        return false;
+    }
+
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char*>(mappedData), int(file.size()));
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic, version;
+    qint32 entriesCount;
+    in >> magic >> version >> entriesCount;
+
+    if( (magic != cacheMagic) | (version != cacheVersion) ){
+        qDebug()<<"[LibraryCache::load]Unknown cache format, ignoring:"<<filePath;
+        unmap();
+        return false;
+    }
+
+    for(int i=0; i<entriesCount; i++){
+        QString name;
+        Entry entry;
+        quint32 notesLength;
+
+        in >> name >> entry.size >> entry.modified >> entry.hash;
+        in >> entry.isDisplayedFirstOnStartup >> entry.redirectTargets >> entry.tags;
+        in >> notesLength;
+
+        entry.notesOffset = in.device()->pos();
+        entry.notesLength = notesLength;
+        if(in.skipRawData(int(notesLength)) != int(notesLength)) break;
+
+        entries.insert(name, entry);
+    }
+
+    if(in.status() != QDataStream::Ok){
+        qDebug()<<"[LibraryCache::load]The cache file is corrupted, ignoring:"<<filePath;
+        entries.clear();
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void LibraryCache::unmap()
+{
+    if(mappedData != nullptr){
+        file.unmap(mappedData);
+        mappedData = nullptr;
+    }
+    file.close();
+}
+
+const LibraryCache::Entry *LibraryCache::validEntry(QString name, QString filePath) //safe to call from the thread pool
+{
+    auto entry = entries.constFind(name);
+    if(entry == entries.constEnd()) return nullptr;
+
+    QFileInfo fileInfo(filePath);
+    if( !fileInfo.exists() | (fileInfo.size() != entry->size) ) return nullptr;
+
+    if(fileInfo.lastModified().toMSecsSinceEpoch() != entry->modified){
+        //The file was touched (sync clients do that), check if the contents actually changed
+        QFile ntFile(filePath);
+        if(!ntFile.open(QIODevice::ReadOnly)) return nullptr;
+        if(contentHash(ntFile.readAll()) != entry->hash) return nullptr;
+    }
+    return &entry.value();
+}
+
+bool LibraryCache::restoreNotes(const Entry *entry, QList<Note *> &notes) //safe to call from the thread pool
+{
+    if( (entry == nullptr) | (mappedData == nullptr) ) return false;
+
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char*>(mappedData + entry->notesOffset), int(entry->notesLength));
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    int notesCount;
+    in >> notesCount;
+    for(int i=0; i<notesCount; i++){
+        notes.push_back(Note::readFromStream(in));
+    }
+
+    if(in.status() != QDataStream::Ok){
+        qDebug()<<"[LibraryCache::restoreNotes]Corrupted cache entry, the notefile will be parsed.";
+        for(Note *nt: notes) delete nt;
+        notes.clear();
+        return false;
+    }
+    return true;
+}
+
+void LibraryCache::save(QList<NoteFile *> noteFiles)
+{
+    QList<QString> names;
+    QList<Entry> newEntries;
+    QList<QByteArray> notesData;
+
+    for(NoteFile *nf: noteFiles){
+        if(nf->isPaged) continue; //only the resident tiles are in memory, parsing the index is quick anyway
+
+        Entry entry;
+        QByteArray data;
+
+        if(nf->isLoaded && !nf->contentHash.isEmpty()){ //The notes in memory are what's on the disk
+            QDataStream out(&data, QIODevice::WriteOnly);
+            out.setVersion(QDataStream::Qt_5_6);
+
+            entry.size = nf->fileSize;
+            entry.modified = nf->fileModified;
+            entry.hash = nf->contentHash;
+            entry.isDisplayedFirstOnStartup = nf->isDisplayedFirstOnStartup;
+
+            out << int(nf->notes.size());
+            for(Note *nt: nf->notes){
+                nt->writeToStream(out);
+
+                if( (nt->type == NoteType::redirecting) && !entry.redirectTargets.contains(nt->redirectTarget) ){
+                    entry.redirectTargets.push_back(nt->redirectTarget); //resolved, relative ones included
+                }
+                for(QString tag: nt->tags){
+                    if(!entry.tags.contains(tag)) entry.tags.push_back(tag);
+                }
+            }
+        }else{ //Keep the old entry if the notefile wasn't opened and hasn't changed
+            const Entry *oldEntry = validEntry(nf->name(), nf->filePath());
+            if(oldEntry == nullptr) continue;
+
+            entry = *oldEntry;
+            data = QByteArray(reinterpret_cast<const char*>(mappedData + oldEntry->notesOffset), int(oldEntry->notesLength));
+        }
+        names.push_back(nf->name());
+        newEntries.push_back(entry);
+        notesData.push_back(data);
+    }
+
+    QSaveFile saveFile(filePath);
+    if(!saveFile.open(QIODevice::WriteOnly)){
+        qDebug()<<"[LibraryCache::save]Failed opening the cache file for writing:"<<filePath;
+        return;
+    }
+    QDataStream out(&saveFile);
+    out.setVersion(QDataStream::Qt_5_6);
+
+    out << cacheMagic << cacheVersion << qint32(names.size());
+    for(int i=0; i<names.size(); i++){
+        const Entry &entry = newEntries[i];
+        out << names[i] << entry.size << entry.modified << entry.hash;
+        out << entry.isDisplayedFirstOnStartup << entry.redirectTargets << entry.tags;
+        out << quint32(notesData[i].size());
+        out.writeRawData(notesData[i].constData(), notesData[i].size());
+    }
+
+    unmap(); //The old snapshot is replaced
+    if(!saveFile.commit()){
+        qDebug()<<"[LibraryCache::save]Failed writing the cache file:"<<filePath;
+    }
+    load();
+}
+
+QByteArray LibraryCache::contentHash(const QByteArray &fileContents)
+{
+    return QCryptographicHash::hash(fileContents, QCryptographicHash::Sha1);
+}
@@ -0,0 +1,62 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBRARYCACHE_H
+#define LIBRARYCACHE_H
+
+#include <QFile>
+#include <QHash>
+#include <QStringList>
+
+class Note;
+class NoteFile;
+
+//A binary snapshot of the parsed notefiles of a library, kept in its folder.
+//An entry is used only while the file's size and modification time match,
+//or (if only the time differs) the content hash does.
+class LibraryCache
+{
+public:
+    struct Entry{
+        qint64 size;
+        qint64 modified; //msecs since epoch
+        QByteArray hash;
+        bool isDisplayedFirstOnStartup;
+        QStringList redirectTargets;
+        QStringList tags;
+        qint64 notesOffset, notesLength; //where the serialized notes are in the mapped file
+    };
+
+    //Functions
+    LibraryCache(QString cacheFilePath);
+    ~LibraryCache();
+
+    bool load();
+    void save(QList<NoteFile*> noteFiles);
+    void unmap();
+
+    const Entry *validEntry(QString name, QString filePath);
+    bool restoreNotes(const Entry *entry, QList<Note*> &notes);
+    static QByteArray contentHash(const QByteArray &fileContents);
+
+    //Variables
+    QString filePath;
+    QFile file;
+    uchar *mappedData = nullptr;
+    QHash<QString, Entry> entries; //by notefile name
+};
+
+#endif // LIBRARYCACHE_H
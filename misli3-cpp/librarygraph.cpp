@@ -0,0 +1,205 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QQueue>
+
+#include "librarygraph.h"
+#include "notefile.h"
+#include "memoryusage.h"
+
+LibraryGraph::Node LibraryGraph::noteFileNode(QString name)
+{
+    return Node(name, noteFileId);
+}
+
+void LibraryGraph::addEdge(Node from, Node to)
+{
+    outEdges[from].insert(to);
+    inEdges[to].insert(from);
+}
+void LibraryGraph::removeEdge(Node from, Node to)
+{
+    auto out = outEdges.find(from);
+    if(out != outEdges.end()){
+        out->remove(to);
+        if(out->isEmpty()) outEdges.erase(out);
+    }
+    auto in = inEdges.find(to);
+    if(in != inEdges.end()){
+        in->remove(from);
+        if(in->isEmpty()) inEdges.erase(in);
+    }
+}
+void LibraryGraph::setOutEdges(Node node, const QSet<Node> &targets) //only the difference is applied
+{
+    QSet<Node> oldTargets = outEdges.value(node);
+    for(const Node &target: oldTargets){
+        if(!targets.contains(target)) removeEdge(node, target);
+    }
+    for(const Node &target: targets){
+        if(!oldTargets.contains(target)) addEdge(node, target);
+    }
+}
+void LibraryGraph::removeNote(Node node)
+{
+    setOutEdges(node, QSet<Node>());
+    auto ids = notesOfNoteFile.find(node.first);
+    if(ids != notesOfNoteFile.end()){
+        ids->remove(node.second);
+        if(ids->isEmpty()) notesOfNoteFile.erase(ids);
+    }
+    //The links pointing to it are removed with the changes of their notes
+}
+
+void LibraryGraph::updateNotes(QString name, QHash<int, Note*> notes)
+{
+    for(auto note = notes.constBegin(); note != notes.constEnd(); ++note){
+        Node node(name, note.key());
+        Note *nt = note.value();
+        if(nt == nullptr){
+            removeNote(node);
+            continue;
+        }
+
+        QSet<Node> targets;
+        for(const Link &ln: nt->outlinks) targets.insert(Node(name, ln.id));
+        if(!nt->redirectTarget.isEmpty()) targets.insert(noteFileNode(nt->redirectTarget));
+
+        setOutEdges(node, targets);
+        notesOfNoteFile[name].insert(note.key());
+    }
+}
+void LibraryGraph::removeNoteFile(QString name)
+{
+    //The notes go, the redirects to the notefile stay (it may come back)
+    for(int id: notesOfNoteFile.value(name)) removeNote(Node(name, id));
+}
+void LibraryGraph::renameNoteFile(QString oldName, QString newName)
+{
+    //Collect the nodes of the notefile, then move them with all their edges
+    QList<Node> oldNodes;
+    oldNodes.push_back(noteFileNode(oldName));
+    QSet<int> ids = notesOfNoteFile.take(oldName);
+    for(int id: ids) oldNodes.push_back(Node(oldName, id));
+
+    QList<QPair<Node, Node>> edges;
+    for(const Node &node: oldNodes){
+        for(const Node &target: outEdges.value(node)) edges.push_back(qMakePair(node, target));
+        for(const Node &source: inEdges.value(node)) edges.push_back(qMakePair(source, node));
+    }
+    for(auto &edge: edges) removeEdge(edge.first, edge.second);
+
+    auto renamed = [&](Node node){
+        if(node.first == oldName) node.first = newName;
+        return node;
+    };
+    for(auto &edge: edges) addEdge(renamed(edge.first), renamed(edge.second));
+    if(!ids.isEmpty()) notesOfNoteFile[newName].unite(ids);
+}
+
+QList<LibraryGraph::Node> LibraryGraph::backlinks(Node node) //the notes linking or redirecting to it
+{
+    return inEdges.value(node).toList();
+}
+QList<LibraryGraph::Node> LibraryGraph::reachableFrom(Node node) //breadth first, the start included
+{
+    QList<Node> visited;
+    QSet<Node> seen;
+    QQueue<Node> queue;
+    queue.enqueue(node);
+    seen.insert(node);
+
+    while(!queue.isEmpty()){
+        Node current = queue.dequeue();
+        visited.push_back(current);
+        for(const Node &next: outEdges.value(current)){
+            if(!seen.contains(next)){
+                seen.insert(next);
+                queue.enqueue(next);
+            }
+        }
+    }
+    return visited;
+}
+QList<LibraryGraph::Node> LibraryGraph::shortestPath(Node from, Node to) //empty if there's none
+{
+    QHash<Node, Node> parents;
+    QQueue<Node> queue;
+    queue.enqueue(from);
+    parents.insert(from, from);
+
+    while(!queue.isEmpty()){
+        Node current = queue.dequeue();
+        if(current == to){
+            QList<Node> path;
+            for(Node node = to; node != from; node = parents.value(node)) path.push_front(node);
+            path.push_front(from);
+            return path;
+        }
+        for(const Node &next: outEdges.value(current)){
+            if(!parents.contains(next)){
+                parents.insert(next, current);
+                queue.enqueue(next);
+            }
+        }
+    }
+    return QList<Node>();
+}
+QList<LibraryGraph::Node> LibraryGraph::component(Node node) //ignoring the directions
+{
+    QList<Node> members;
+    QSet<Node> seen;
+    QQueue<Node> queue;
+    queue.enqueue(node);
+    seen.insert(node);
+
+    while(!queue.isEmpty()){
+        Node current = queue.dequeue();
+        members.push_back(current);
+        for(const QSet<Node> &neighbours: {outEdges.value(current), inEdges.value(current)}){
+            for(const Node &next: neighbours){
+                if(!seen.contains(next)){
+                    seen.insert(next);
+                    queue.enqueue(next);
+                }
+            }
+        }
+    }
+    return members;
+}
+QList<QList<LibraryGraph::Node>> LibraryGraph::components()
+{
+    QList<QList<Node>> result;
+    QSet<Node> assigned;
+
+    QList<Node> nodes = outEdges.keys() + inEdges.keys();
+    for(const Node &node: nodes){
+        if(assigned.contains(node)) continue;
+        QList<Node> members = component(node);
+        for(const Node &member: members) assigned.insert(member);
+        result.push_back(members);
+    }
+    return result;
+}
+qint64 LibraryGraph::memoryUsage() //estimated bytes, the names are shared with the notefiles
+{
+    qint64 bytes = memorySize(outEdges) + memorySize(inEdges) + memorySize(notesOfNoteFile);
+    for(const QSet<int> &ids: notesOfNoteFile) bytes += ids.size() * qint64(sizeof(int) + 2 * sizeof(void*)) + ids.capacity() * qint64(sizeof(void*));
+    for(const QHash<Node, QSet<Node>> &edges: {outEdges, inEdges}){
+        for(const QSet<Node> &targets: edges) bytes += targets.size() * qint64(sizeof(Node) + 2 * sizeof(void*)) + targets.capacity() * qint64(sizeof(void*));
+    }
+    return bytes;
+}
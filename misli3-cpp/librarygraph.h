@@ -0,0 +1,64 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBRARYGRAPH_H
+#define LIBRARYGRAPH_H
+
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+
+class Note;
+
+//The links of a library as one graph. The nodes are the notes, as (notefile
+//name, note id), and the notefiles, as (name, noteFileId). The edges are the
+//links between notes and the redirecting notes to their target notefiles.
+//Which notes a notefile holds is kept apart (notesOfNoteFile), so it doesn't
+//show up as edges in the queries. It's updated per changed note (see
+//NoteFile::notesChanged()), and the queries only visit what they return.
+class LibraryGraph
+{
+public:
+    typedef QPair<QString, int> Node;
+    static const int noteFileId = -2147483647 - 1; //the id of a notefile's own node
+
+    //Functions
+    static Node noteFileNode(QString name);
+
+    void updateNotes(QString noteFileName, QHash<int, Note*> notes); //nullptr for the deleted ones
+    void removeNoteFile(QString name);
+    void renameNoteFile(QString oldName, QString newName);
+
+    QList<Node> backlinks(Node node);
+    QList<Node> reachableFrom(Node node);
+    QList<Node> shortestPath(Node from, Node to);
+    QList<Node> component(Node node);
+    QList<QList<Node>> components();
+    qint64 memoryUsage();
+
+    //Variables
+    QHash<Node, QSet<Node>> outEdges, inEdges;
+    QHash<QString, QSet<int>> notesOfNoteFile; //the ids with a node, per notefile name
+
+private:
+    void addEdge(Node from, Node to);
+    void removeEdge(Node from, Node to);
+    void setOutEdges(Node node, const QSet<Node> &targets);
+    void removeNote(Node node);
+};
+
+#endif // LIBRARYGRAPH_H
@@ -65,3 +65,16 @@ QJsonObject Link::toJsonObject()
 
     return json;
 }
+
+Link Link::readFromStream(QDataStream &in) //includes the geometry, so arrangeLinksGeometry() can be skipped
+{
+    Link ln(0);
+    in >> ln.id >> ln.text >> ln.line >> ln.autoLine >> ln.controlPoint;
+    in >> ln.usesControlPoint >> ln.controlPointIsSet >> ln.controlPointIsChanged;
+    return ln;
+}
+void Link::writeToStream(QDataStream &out)
+{
+    out << id << text << line << autoLine << controlPoint;
+    out << usesControlPoint << controlPointIsSet << controlPointIsChanged;
+}
@@ -21,6 +21,7 @@
 #include <QLineF>
 #include <QPointF>
 #include <QPainterPath>
+#include <QDataStream>
 
 class Note;
 
@@ -35,6 +36,8 @@ public:
     QPointF realControlPoint();
     static Link fromJsonObject(QJsonObject obj);
     QJsonObject toJsonObject();
+    static Link readFromStream(QDataStream &in);
+    void writeToStream(QDataStream &out);
 
     //Hard variables
     int id;
@@ -0,0 +1,59 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QImage>
+#include <QPainterPath>
+#include <QString>
+#include <QStringList>
+
+//Rough heap sizes for the memory accounting (see NoteFile::memoryUsage()).
+//They count the payload and Qt's headers, not the allocator's overhead, and
+//shared data is counted by every owner unless the caller checks for it.
+
+inline qint64 memorySize(const QString &string)
+{
+    return string.isNull() ? 0 : qint64(sizeof(QArrayData)) + (string.capacity() + 1) * qint64(sizeof(QChar));
+}
+inline qint64 memorySize(const QByteArray &array)
+{
+    return array.isNull() ? 0 : qint64(sizeof(QArrayData)) + array.capacity() + 1;
+}
+inline qint64 memorySize(const QStringList &list)
+{
+    qint64 size = list.size() * qint64(sizeof(void*));
+    for(const QString &string: list) size += memorySize(string);
+    return size;
+}
+inline qint64 memorySize(const QPainterPath &path)
+{
+    return path.isEmpty() ? 0 : path.elementCount() * qint64(sizeof(QPainterPath::Element)) + 64; //+ the private
+}
+inline qint64 memorySize(const QImage &image)
+{
+    return image.byteCount();
+}
+template <class Key, class T>
+inline qint64 memorySize(const QHash<Key, T> &hash) //the nodes and the buckets, not what the keys and values point to
+{
+    return hash.size() * qint64(sizeof(Key) + sizeof(T) + 2 * sizeof(void*)) + hash.capacity() * qint64(sizeof(void*));
+}
+
+#endif // MEMORYUSAGE_H
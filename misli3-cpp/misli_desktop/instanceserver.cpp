@@ -0,0 +1,141 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "instanceserver.h"
+#include "../global.h"
+
+InstanceServer::InstanceServer(QObject *parent) :
+    QObject(parent)
+{
+    isHandlingCommands = false;
+    server = new QLocalServer(this);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server,SIGNAL(newConnection()),this,SLOT(handleNewConnection()));
+}
+
+QString InstanceServer::serverName() //per user, the socket names may be shared on the machine
+{
+#ifdef Q_OS_UNIX
+    return "misli-" + QString::number(getuid());
+#else
+    QString user = QString::fromLocal8Bit(qgetenv("USERNAME"));
+    if(user.isEmpty()) user = QString::fromLocal8Bit(qgetenv("USER"));
+    return "misli-" + user;
+#endif
+}
+QStringList InstanceServer::commandsFromArguments(QStringList arguments)
+{
+    QStringList commands;
+
+    for(int i=1; i<arguments.size(); i++){
+        if( (arguments[i] == "--open") && (i + 1 < arguments.size()) ){
+            commands.push_back("open " + arguments[++i]);
+        }else if(arguments[i] == "--quit"){
+            commands.push_back("quit");
+        }
+    }
+    if(commands.isEmpty()) commands.push_back("raise"); //a plain launch
+    return commands;
+}
+InstanceServer::SendResult InstanceServer::sendToRunningInstance(QStringList commands)
+{
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if(!socket.waitForConnected(INSTANCE_SERVER_TIMEOUT)){
+        //Only these mean nobody is there. A timeout may be an instance that's busy starting up
+        QLocalSocket::LocalSocketError err = socket.error();
+        if( (err == QLocalSocket::ServerNotFoundError) | (err == QLocalSocket::ConnectionRefusedError) ) return NotRunning;
+        return NoReply;
+    }
+
+    socket.write((commands.join("\n") + "\n").toUtf8());
+    if(!socket.waitForBytesWritten(INSTANCE_SERVER_TIMEOUT)) return NoReply;
+
+    //The reply tells the commands were taken
+    while(!socket.canReadLine()){
+        if(!socket.waitForReadyRead(INSTANCE_SERVER_TIMEOUT)) return NoReply;
+    }
+    return (socket.readLine().trimmed() == "ok") ? Sent : NoReply;
+}
+bool InstanceServer::listen(bool replaceStale) //replaceStale only right after sendToRunningInstance() gave NotRunning, the socket may be another launch's
+{
+    if(replaceStale) QLocalServer::removeServer(serverName()); //left over from a crash
+    if(server->listen(serverName())) return true;
+
+    qDebug()<<"[InstanceServer::listen]Failed listening:"<<server->errorString();
+    return false;
+}
+
+void InstanceServer::startHandlingCommands() //once the app is set up, with the ones that came before
+{
+    isHandlingCommands = true;
+
+    //From the event loop, quit() does nothing before it runs
+    QStringList commands;
+    commands.swap(queuedCommands);
+    QTimer::singleShot(0, this, [=](){
+        for(QString command: commands) handleCommand(command);
+    });
+}
+
+void InstanceServer::handleNewConnection()
+{
+    while(server->hasPendingConnections()){
+        QLocalSocket *socket = server->nextPendingConnection();
+        connect(socket, &QLocalSocket::readyRead, this, [=](){
+            readCommands(socket);
+        });
+        connect(socket,SIGNAL(disconnected()),socket,SLOT(deleteLater()));
+        readCommands(socket); //may have come with the connection
+    }
+}
+void InstanceServer::readCommands(QLocalSocket *socket)
+{
+    bool gotCommands = false;
+
+    while(socket->canReadLine()){
+        QString command = QString::fromUtf8(socket->readLine()).trimmed();
+        gotCommands = true;
+
+        if(isHandlingCommands){
+            handleCommand(command);
+        }else{
+            queuedCommands.push_back(command);
+        }
+    }
+    if(gotCommands) socket->write("ok\n");
+}
+void InstanceServer::handleCommand(QString command)
+{
+    if(command == "raise"){
+        emit raiseRequested();
+    }else if(command.startsWith("open ")){
+        emit openRequested(command.mid(5));
+    }else if(command == "quit"){
+        emit quitRequested();
+    }else{
+        qDebug()<<"[InstanceServer::handleCommand]Unknown command:"<<command;
+    }
+}
@@ -0,0 +1,68 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTANCESERVER_H
+#define INSTANCESERVER_H
+
+#include <QObject>
+#include <QStringList>
+
+class QLocalServer;
+class QLocalSocket;
+
+//Keeps misli to one process per user. The first one listens on a local
+//socket. The later launches (and scripts) send it their command line as
+//commands, one per line, and exit:
+//  raise              show the window
+//  open <notefile>    open a notefile by name (or file path) in a new tab
+//  quit               exit the resident process
+class InstanceServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum SendResult{
+        Sent,
+        NotRunning, //nobody listens on the socket, it's missing or stale
+        NoReply //connected, but the commands weren't confirmed in time (e.g. it's starting up)
+    };
+
+    //Functions
+    InstanceServer(QObject *parent = nullptr);
+
+    static QString serverName();
+    static QStringList commandsFromArguments(QStringList arguments);
+    static SendResult sendToRunningInstance(QStringList commands);
+    bool listen(bool replaceStale = false);
+    void startHandlingCommands();
+
+    //Variables
+    QLocalServer *server;
+    bool isHandlingCommands; //until then they're queued, the app is starting up
+    QStringList queuedCommands;
+
+signals:
+    void raiseRequested();
+    void openRequested(QString noteFile);
+    void quitRequested();
+
+private slots:
+    void handleNewConnection();
+    void readCommands(QLocalSocket *socket);
+    void handleCommand(QString command);
+};
+
+#endif // INSTANCESERVER_H
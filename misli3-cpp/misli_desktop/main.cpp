@@ -25,6 +25,7 @@
 int main(int argc, char *argv[])
 {
     MisliDesktopGui misli(argc, argv);
+    if(misli.isSecondaryInstance) return 0; //handed over to the running one
 
     //Timeline modules
     Timeline *timeline = misli.misliWindow->timelineWidget.timeline;
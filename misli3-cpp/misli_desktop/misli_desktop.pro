@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT += core gui widgets network xml multimedia sql
+QT += core gui widgets network xml multimedia sql concurrent
 
 android{
 QT += androidextras
@@ -43,15 +43,26 @@ TRANSLATIONS += ../translations/misli_bg.ts
 
 HEADERS += \
     ../canvaswidget.h \
+    ../directorywatcher.h \
+    ../folderscanner.h \
     ../global.h \
     ../library.h \
+    ../librarycache.h \
+    ../librarygraph.h \
     ../link.h \
+    ../memoryusage.h \
     ../note.h \
     ../notefile.h \
     ../notessearch.h \
+    ../sqlstorage.h \
+    ../tagindex.h \
+    ../timeindex.h \
+    ../trigramindex.h \
     ../util.h \
+    ../versionstore.h \
     editnotedialogue.h \
     mislidesktopgui.h \
+    instanceserver.h \
     misliwindow.h \
     timelinewidget.h \
     timeline.h \
@@ -64,15 +75,25 @@ HEADERS += \
 
 SOURCES += \
     ../canvaswidget.cpp \
+    ../directorywatcher.cpp \
+    ../folderscanner.cpp \
     ../library.cpp \
+    ../librarycache.cpp \
+    ../librarygraph.cpp \
     ../link.cpp \
     ../note.cpp \
     ../notefile.cpp \
     ../notessearch.cpp \
+    ../sqlstorage.cpp \
+    ../tagindex.cpp \
+    ../timeindex.cpp \
+    ../trigramindex.cpp \
     ../util.cpp \
+    ../versionstore.cpp \
     editnotedialogue.cpp \
     main.cpp \
     mislidesktopgui.cpp \
+    instanceserver.cpp \
     misliwindow.cpp \
     timelinewidget.cpp \
     timeline.cpp \
@@ -17,12 +17,16 @@
 #include <QMessageBox>
 #include <QInputDialog>
 #include <QFileDialog>
-#include <QFileSystemWatcher>
+
 #include <QStandardPaths>
+#include <QDir>
+#include <QFileInfo>
+#include <QMenu>
 
 #include "mislidesktopgui.h"
 #include "../global.h"
 #include "../canvaswidget.h"
+#include "../library.h"
 
 MisliDesktopGui::MisliDesktopGui(int argc, char *argv[]) :
     QApplication(argc,argv)
@@ -34,6 +38,32 @@ MisliDesktopGui::MisliDesktopGui(int argc, char *argv[]) :
     setApplicationName("misli");
     setApplicationVersion(MISLI_VERSION);
 
+    //One process per user, so there's one writer per library. A later launch hands over its command line and exits
+    QStringList commands = InstanceServer::commandsFromArguments(arguments());
+    InstanceServer::SendResult sendResult = InstanceServer::sendToRunningInstance(commands);
+    if(sendResult != InstanceServer::NotRunning){
+        if(sendResult == InstanceServer::NoReply) qDebug()<<"[MisliDesktopGui]The running instance didn't answer in time, it may be starting up";
+        isSecondaryInstance = true;
+        return;
+    }
+    if(commands.contains("quit")){ //nothing to quit
+        isSecondaryInstance = true;
+        return;
+    }
+    //Commands from the later launches. The ones that come during the startup wait for startHandlingCommands()
+    instanceServer = new InstanceServer(this);
+    connect(instanceServer, &InstanceServer::raiseRequested, this, &MisliDesktopGui::raiseWindow);
+    connect(instanceServer, &InstanceServer::openRequested, this, &MisliDesktopGui::openNoteFileFromCommand);
+    connect(instanceServer, &InstanceServer::quitRequested, this, &MisliDesktopGui::quit);
+    if(!instanceServer->listen()){
+        //Another launch may have started listening since. The socket is stale only if nobody is there
+        if(InstanceServer::sendToRunningInstance(commands) != InstanceServer::NotRunning){
+            isSecondaryInstance = true;
+            return;
+        }
+        instanceServer->listen(true);
+    }
+
     //Construct the splash screen
     QSplashScreen splash(QPixmap(":/img/icon.png"));
     splash.show();
@@ -65,51 +95,71 @@ MisliDesktopGui::MisliDesktopGui(int argc, char *argv[]) :
         qDebug()<<"Loading notes dirs:" <<  notesDirs;
     }
 
-    if(notesDirs.size() != 1){
-        qDebug() << "Bad notes dirs size (!=1)";
-        if(notesDirs.size()>1){ //Get the firs from the old config if present
-            notesDirs = QStringList(notesDirs[0]);
-        }else{ // Or request a folder
-            QWidget dummyWidget;
-            QString storageChoice = QInputDialog::getItem(&dummyWidget,
-                                                        tr("Set the storage folder"),
-                                                        tr("Set the storage folder:"),
-                                                        QStringList() << "Use default folder" << "Choose folder", 0,
-                                                        false);
-            if(storageChoice == "Use default folder"){
+    if(notesDirs.isEmpty()){ //Request a folder
+        qDebug() << "No notes dirs set";
+        QWidget dummyWidget;
+        QString storageChoice = QInputDialog::getItem(&dummyWidget,
+                                                    tr("Set the storage folder"),
+                                                    tr("Set the storage folder:"),
+                                                    QStringList() << "Use default folder" << "Choose folder", 0,
+                                                    false);
+        if(storageChoice == "Use default folder"){
+            notesDirs = QStringList(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+        }else{
+            QString storageFolder = QFileDialog::getExistingDirectory(&dummyWidget,
+                                                        tr("Choose a storage folder"),
+                                                        tr("Choose a storage folder:"));
+            if(storageFolder.isEmpty()){
                 notesDirs = QStringList(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
             }else{
-                QString storageFolder = QFileDialog::getExistingDirectory(&dummyWidget,
-                                                            tr("Choose a storage folder"),
-                                                            tr("Choose a storage folder:"));
-                if(storageFolder.isEmpty()){
-                    notesDirs = QStringList(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
-                }else{
-                    notesDirs = QStringList(storageFolder);
-                }
+                notesDirs = QStringList(storageFolder);
             }
         }
         QSettings().setValue("notes_dir", notesDirs);
     }
 
-    //Construct the misli instance class
-    misliLibrary = new Library(notesDirs[0]);
+    //Construct the libraries. Only their default notefiles get loaded here
+    notesDirs.removeDuplicates();
+    for(QString folderPath: notesDirs) libraries.push_back(new Library(folderPath));
 
     misliWindow = new MisliWindow(this);
     misliWindow->showMaximized();
-    if(misliLibrary->defaultNoteFile() != nullptr){
-        misliWindow->openNoteFileInNewTab(misliLibrary->defaultNoteFile());
+    if(libraries.first()->defaultNoteFile() != nullptr){
+        misliWindow->openNoteFileInNewTab(libraries.first()->defaultNoteFile());
         misliWindow->ui->tabWidget->setCurrentIndex(0);
     }
+    misliWindow->updateDirListMenu();
+
+    for(QString command: commands){ //this launch's own
+        if(command.startsWith("open ")) openNoteFileFromCommand(command.mid(5));
+    }
+
+    //Closing the window keeps the process (and the loaded libraries) around, it's shown again from the tray or a launch
+    if(QSystemTrayIcon::isSystemTrayAvailable()){
+        trayIcon = new QSystemTrayIcon(QIcon(":/img/icon.png"), this);
+        QMenu *trayMenu = new QMenu;
+        connect(trayMenu->addAction(tr("Show")), &QAction::triggered, this, &MisliDesktopGui::raiseWindow);
+        connect(trayMenu->addAction(tr("Quit")), &QAction::triggered, this, &MisliDesktopGui::quit);
+        trayIcon->setContextMenu(trayMenu);
+        connect(trayIcon, &QSystemTrayIcon::activated, this, &MisliDesktopGui::raiseWindow);
+        trayIcon->setVisible(isResident());
+    }
 
     splash.finish(misliWindow);
 
     workerThread.start(); //Used for search results finding
+
+    //The rest of the notefiles load while the default one is already usable. The libraries load side by side
+    for(Library *lib: libraries) startLoading(lib);
+
+    instanceServer->startHandlingCommands();
 }
 MisliDesktopGui::~MisliDesktopGui()
 {
     delete misliWindow;
     delete translator;
+    for(Library *lib: libraries) delete lib; //saves the library caches
+    if(trayIcon != nullptr) delete trayIcon->contextMenu();
 
     workerThread.quit();
     workerThread.wait();
@@ -163,3 +213,81 @@ QString MisliDesktopGui::language()
 {
     return QSettings().value("language",QVariant("en")).toString();
 }
+
+bool MisliDesktopGui::isResident() //stays running when the window is closed
+{
+    return (trayIcon != nullptr) && instanceServer->server->isListening() && QSettings().value("stay_resident", true).toBool();
+}
+void MisliDesktopGui::raiseWindow()
+{
+    misliWindow->show();
+    misliWindow->raise();
+    misliWindow->activateWindow();
+}
+void MisliDesktopGui::openNoteFileFromCommand(QString noteFile) //a name ("folder/name" for the subfolders) or a file path
+{
+    for(Library *lib: libraries){
+        NoteFile *nf = lib->noteFileByName(noteFile);
+        if( (nf == nullptr) && QFileInfo(noteFile).isAbsolute() ){
+            nf = lib->noteFileByName(lib->noteFileNameForPath(noteFile));
+            if( (nf != nullptr) && (QFileInfo(nf->filePath()) != QFileInfo(noteFile)) ) nf = nullptr; //same name in another folder
+        }
+        if(nf != nullptr){
+            misliWindow->openNoteFileInNewTab(nf);
+            misliWindow->ui->tabWidget->setCurrentIndex(misliWindow->ui->tabWidget->count() - 2); //before the timeline
+            raiseWindow();
+            return;
+        }
+    }
+    qDebug()<<"[MisliDesktopGui::openNoteFileFromCommand]No such note file:"<<noteFile;
+    raiseWindow();
+}
+Library *MisliDesktopGui::libraryOf(NoteFile *nf) //nullptr if it's unloaded or virtual
+{
+    if(nf == nullptr) return nullptr;
+
+    for(Library *lib: libraries){
+        if(lib->noteFileByName(nf->name()) == nf) return lib;
+    }
+    return nullptr;
+}
+void MisliDesktopGui::startLoading(Library *lib)
+{
+    connect(lib, &Library::scanningProgress, misliWindow, &MisliWindow::showScanningProgress);
+    connect(lib, &Library::loadingProgress, misliWindow, &MisliWindow::showLoadingProgress);
+    connect(lib, &Library::loadingFinished, misliWindow, &MisliWindow::handleLibraryLoaded);
+    connect(lib, &Library::noteFileAboutToBeUnloaded, misliWindow, &MisliWindow::handleNoteFileUnloading);
+    connect(lib, &Library::mergeConflicts, misliWindow, &MisliWindow::showMergeConflicts);
+    lib->loadNoteFilesInBackground();
+}
+void MisliDesktopGui::saveLibraryPaths()
+{
+    QStringList notesDirs;
+    for(Library *lib: libraries) notesDirs.push_back(lib->folderPath);
+    QSettings().setValue("notes_dir", notesDirs);
+}
+Library *MisliDesktopGui::addLibrary(QString folderPath)
+{
+    for(Library *lib: libraries){
+        if(QDir(lib->folderPath) == QDir(folderPath)) return lib; //open already
+    }
+
+    Library *lib = new Library(folderPath);
+    libraries.push_back(lib);
+    saveLibraryPaths();
+
+    startLoading(lib);
+    misliWindow->updateDirListMenu();
+    return lib;
+}
+void MisliDesktopGui::removeLibrary(Library *lib) //closes it, the folder stays as it is
+{
+    if( (libraries.size() < 2) | !libraries.contains(lib) ) return; //there's always one
+
+    //Out of the list first, so the canvases switch to the other libraries
+    libraries.removeOne(lib);
+    saveLibraryPaths();
+    delete lib;
+
+    misliWindow->updateDirListMenu();
+}
@@ -23,8 +23,10 @@
 #include <QSplashScreen>
 #include <QFutureWatcher>
 #include <QThread>
+#include <QSystemTrayIcon>
 
 #include "misliwindow.h"
+#include "instanceserver.h"
 
 class MisliDesktopGui : public QApplication
 {
@@ -38,19 +40,34 @@ public:
     //Properties
     QString language();
 
+    Library *libraryOf(NoteFile *nf);
+    bool isResident();
+
     //Variables
     MisliWindow * misliWindow = nullptr;
-    Library * misliLibrary;
+    QList<Library*> libraries; //all open at the same time, each loading on its own
     QThread workerThread;
     bool clearSettingsOnExit = false;
+    bool isSecondaryInstance = false; //the commands went to the running instance, nothing else was set up
+    InstanceServer *instanceServer = nullptr;
+    QSystemTrayIcon *trayIcon = nullptr; //while resident
 
 private:
     QTranslator *translator = nullptr;
 
+    void startLoading(Library *lib);
+    void saveLibraryPaths();
+
 public slots:
     //Properties
     void setLanguage(QString);
     void updateTranslator();
+
+    //Other
+    Library *addLibrary(QString folderPath);
+    void removeLibrary(Library *lib);
+    void raiseWindow();
+    void openNoteFileFromCommand(QString noteFile);
 };
 
 #endif // MISLIDESKTOPGUI_H
@@ -14,6 +14,7 @@
     along with Misli.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <QInputDialog>
 #include <QMessageBox>
 #include <QFileDialog>
@@ -23,6 +24,10 @@
 #include <QLayout>
 #include <QComboBox>
 #include <QListView>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPushButton>
 
 #ifdef Q_OS_ANDROID
 #include <QtAndroidExtras/QtAndroid>
@@ -49,8 +54,6 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
 
     //---Init notes search stuff---
     notes_search = new NotesSearch(this, 1);
-    notes_search->moveToThread(&misliDesktopGUI->workerThread);
-    notes_search->loadNotes();
     ui->searchListView->setModel(notes_search);
     QItemSelectionModel *selectionModel = ui->searchListView->selectionModel();
 
@@ -123,16 +126,17 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
     connect(ui->actionZoom_out,&QAction::triggered,this,&MisliWindow::zoomOut);
     connect(ui->actionHelp,&QAction::triggered,this,&MisliWindow::toggleHelp);
     connect(ui->actionMake_this_notefile_appear_first_on_program_start,&QAction::triggered,this,&MisliWindow::makeNoteFileDefault);
-//    connect(ui->actionRemove_current,&QAction::triggered,this,&MisliWindow::removeCurrentFolder);
+    connect(ui->actionRemove_current,&QAction::triggered,this,&MisliWindow::removeCurrentFolder);
     connect(ui->actionTransparent_background,&QAction::triggered,this,&MisliWindow::colorTransparentBackground);
     connect(ui->actionDelete_notefile,&QAction::triggered,this,&MisliWindow::deleteNoteFileFromFS);
 //    connect(ui->jumpToNearestNotePushButton,&QPushButton::clicked,currentCanvas(),&CanvasWidget::jumpToNearestNote);
-//    connect(ui->actionAdd_new,&QAction::triggered,this,&MisliWindow::addNewFolder);
+    connect(ui->actionAdd_new,&QAction::triggered,this,&MisliWindow::addNewFolder);
     connect(ui->addMisliDirPushButton,&QPushButton::clicked,this,&MisliWindow::addNewFolder);
     connect(ui->menuFolders,&QMenu::triggered,this,&MisliWindow::handleFoldersMenuClick);
     connect(ui->menuSwitch_to_another_note_file,&QMenu::triggered,this,&MisliWindow::handleNoteFilesMenuClick);
     connect(ui->makeNoteFilePushButton,&QPushButton::clicked,this,&MisliWindow::newNoteFile);
     connect(ui->actionRename_notefile,&QAction::triggered,this,&MisliWindow::renameNoteFile);
+    connect(ui->actionRestore_a_previous_version,&QAction::triggered,this,&MisliWindow::restoreNoteFileVersion);
     connect(ui->actionMake_this_view_point_default_for_the_notefile,&QAction::triggered,this,&MisliWindow::makeViewpointDefault);
     connect(ui->actionCopy,&QAction::triggered,this,&MisliWindow::copySelectedNotesToClipboard);
 
@@ -141,15 +145,23 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
     connect(selectionModel, &QItemSelectionModel::selectionChanged, this,
             [&](const QItemSelection &, const QItemSelection &){
         const QModelIndex index = ui->searchListView->selectionModel()->currentIndex();
+        if(!index.isValid()) return; //the results are being replaced
         NotesSearch::SearchItem searchItem = notes_search->searchResults.at(index.row());
         //Set the last noteFile for the Back function if appropriate
         //if( (searchItem.md==currentDir()) && (searchItem.nf!=canvas->noteFile()) ){
 
         //}
 //        currentCanvas()->setCurrentDir(searchItem.lib);
-        currentCanvasWidget()->setNoteFile(searchItem.nf);
-        if(searchItem.nf->notes.contains(searchItem.nt)){
-            currentCanvasWidget()->centerEyeOnNote(searchItem.nt);
+        currentCanvasWidget()->setNoteFile(searchItem.nf); //switches the library too
+        Note *nt = searchItem.nf->getNoteById(searchItem.noteId);
+        if(nt != nullptr){
+            currentCanvasWidget()->centerEyeOnNote(nt);
+            ui->searchListView->clearSelection();
+        }else if(searchItem.nf->noteExists(searchItem.noteId)){ //in a tile that isn't loaded, it's loaded around the eye
+            QPointF center = searchItem.nf->noteRectById(searchItem.noteId).center();
+            searchItem.nf->eyeX = center.x();
+            searchItem.nf->eyeY = center.y();
+            currentCanvasWidget()->update();
             ui->searchListView->clearSelection();
         }else{//If the note was deleted
             notes_search->findByText(ui->searchLineEdit->text());
@@ -281,7 +293,6 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
     });
     //Instant search on typing in the searchLineEdit (lambda)
     connect(ui->searchLineEdit,&QLineEdit::textChanged,[&](QString text){
-        notes_search->searchResults.clear();
         notes_search->findByText(text);
     });
     //Emulate left click on enter (return) press (lambda)
@@ -313,6 +324,26 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
         misliDesktopGUI->exit(0);
     });
 
+    //Storage backend (lambdas). The library opens the database on the next start
+    ui->actionStore_notes_in_a_database->setChecked(settings.value("sqlite_storage", false).toBool());
+    ui->actionExport_the_database_to_json_files->setEnabled(misliLibrary()->sqlStorage != nullptr);
+    ui->actionRestore_a_previous_version->setEnabled(misliLibrary()->versionStore != nullptr);
+    connect(ui->actionStore_notes_in_a_database,&QAction::triggered,this,[&](bool checked){
+        settings.setValue("sqlite_storage", checked);
+        QMessageBox::information(this, tr("FYI"), tr("The change will take effect after a restart. "
+                                                     "The .json files are imported the first time the database is used."));
+    });
+    connect(ui->actionExport_the_database_to_json_files,&QAction::triggered,this,[&](){
+        int exported = misliLibrary()->sqlStorage->exportToJsonFolder(misliLibrary()->folderPath);
+        statusBar()->showMessage(tr("Exported %1 note files.").arg(exported), 3000);
+    });
+    connect(ui->actionShow_memory_usage,&QAction::triggered,this,&MisliWindow::showMemoryUsage);
+    ui->actionKeep_running_in_the_background->setChecked(settings.value("stay_resident", true).toBool());
+    connect(ui->actionKeep_running_in_the_background,&QAction::triggered,this,[&](bool checked){
+        settings.setValue("stay_resident", checked);
+        if(misliDesktopGUI->trayIcon != nullptr) misliDesktopGUI->trayIcon->setVisible(misliDesktopGUI->isResident());
+    });
+
     //Switch to tab 1
     connect(ui->actionGotoTab1, &QAction::triggered, this, [&](){
         ui->tabWidget->setCurrentIndex(0);
@@ -340,6 +371,7 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
         jsFile.close();
         styleFile.close();
 
+        misliLibrary()->parseAllNoteFiles();
         for(NoteFile *nf: misliLibrary()->noteFiles()){
             QFile file(webDir.absoluteFilePath(nf->name()+".html"));
             file.open(QIODevice::WriteOnly);
@@ -436,7 +468,7 @@ MisliWindow::MisliWindow(MisliDesktopGui * misli_dg_):
 
     //---------------------Creating the virtual note files----------------------
     clipboardNoteFile = new NoteFile;
-    clipboardNoteFile->filePath_m = "clipboardNoteFile";
+    clipboardNoteFile->setFilePath("clipboardNoteFile");
     helpNoteFile = new NoteFile;
     helpNoteFile->setPathAndLoad(":/help/help_"+misliDesktopGUI->language()+".misl");
 
@@ -483,12 +515,19 @@ bool MisliWindow::timelineTabIsActive()
 }
 void MisliWindow::closeEvent(QCloseEvent *)
 {
+    if(misliDesktopGUI->isResident()){ //only hidden, the next launch shows it again right away
+        for(Library *lib: misliDesktopGUI->libraries){
+            for(NoteFile *nf: lib->noteFiles_m) nf->flushPendingWrite();
+        }
+        return;
+    }
     misliDesktopGUI->setQuitOnLastWindowClosed(true);
 }
 
-Library* MisliWindow::misliLibrary()
+Library* MisliWindow::misliLibrary() //of the current tab
 {
-    return misliDesktopGUI->misliLibrary;
+    if(currentCanvasWidget() != nullptr) return currentCanvasWidget()->library();
+    return misliDesktopGUI->libraries.isEmpty() ? nullptr : misliDesktopGUI->libraries.first();
 }
 
 
@@ -598,14 +637,46 @@ void MisliWindow::deleteNoteFileFromFS()
     //If the user confirms
     if(ret==QMessageBox::Ok){
         QString filePath = currentCanvasWidget()->noteFile()->filePath(); //It gets deleted with the soft delete
-        misliLibrary()->unloadNoteFile(currentCanvasWidget()->noteFile()); //Before the hard delete (fs_watch gets disabled there)
+        QString name = currentCanvasWidget()->noteFile()->name();
+        QString tilesFolderPath = currentCanvasWidget()->noteFile()->tilesFolderPath(); //if it's paged
+        misliLibrary()->unloadNoteFile(currentCanvasWidget()->noteFile()); //Before the hard delete, so the removal isn't handled as an external one
         currentCanvasWidget()->setNoteFile(nullptr);
-        if(!dir.remove(filePath)){
+        if(misliLibrary()->sqlStorage != nullptr){
+            if(!misliLibrary()->sqlStorage->removeNoteFile(name)){
+                QMessageBox::information(this, tr("FYI"),tr("Could not delete the note file from the database."));
+            }
+        }else if(!dir.remove(filePath)){
             QMessageBox::information(this, tr("FYI"),tr("Could not delete the file from the file system.Check your permissions."));
         }
+        if(QDir(tilesFolderPath).exists()) QDir(tilesFolderPath).removeRecursively();
 
     }
 }
+void MisliWindow::restoreNoteFileVersion() //from the library's version store, newest first
+{
+    if(currentCanvasWidget() == nullptr) return;
+    NoteFile *nf = currentCanvasWidget()->noteFile();
+    VersionStore *versionStore = misliLibrary()->versionStore;
+    if( (nf == nullptr) | (versionStore == nullptr) ) return;
+
+    int count = versionStore->versionCount(nf->name());
+    QStringList times;
+    for(int i=count-1; i>=0; i--){
+        times.push_back(versionStore->versionTime(nf->name(), i).toString("d.M.yyyy H:mm:ss.zzz"));
+    }
+    if(times.isEmpty()){
+        QMessageBox::information(this, tr("FYI"), tr("There are no saved versions of this note file."));
+        return;
+    }
+
+    bool ok;
+    QString time = QInputDialog::getItem(this, tr("Restore a previous version"), tr("Saved on:"), times, 0, false, &ok);
+    if(!ok) return;
+
+    if(nf->restoreVersion(count - 1 - times.indexOf(time)) != 0){
+        QMessageBox::warning(this, tr("Warning"), tr("Could not restore the version (paged note files are not supported)."));
+    }
+}
 void MisliWindow::nextNoteFile()
 {
     for(int i=0;i<(misliLibrary()->noteFiles_m.size()-1);i++){ //for every notefile without the last one
@@ -670,15 +741,10 @@ void MisliWindow::makeNoteFileDefault()
         }
     }
 }
-//void MisliWindow::removeCurrentFolder()
-//{
-//    misliLibrary()->removeDir(currentDir());
-//    if(misliLibrary()->misliDirs().isEmpty()){
-////        currentCanvas()->setCurrentDir(nullptr);
-//    }else{
-////        currentCanvas()->setCurrentDir(misliInstance()->misliDirs().last());
-//    }
-//}
+void MisliWindow::removeCurrentFolder()
+{
+    misliDesktopGUI->removeLibrary(misliLibrary()); //the canvases switch to the other ones
+}
 void MisliWindow::updateTitle()
 {
     QString title;
@@ -738,21 +804,22 @@ void MisliWindow::updateNoteFilesListMenu()
         if(nf == currentCanvasWidget()->noteFile()) action->setChecked(true);
     }
 }
-//void MisliWindow::updateDirListMenu()
-//{
-//    //Clear the old list
-//    while(ui->menuFolders->actions().size()>2){ //Until the only actions left are the add/remove buttons
-//        //Remove the last action
-//        ui->menuFolders->removeAction(ui->menuFolders->actions().at(ui->menuFolders->actions().size()-1));
-//    }
+void MisliWindow::updateDirListMenu()
+{
+    //Clear the old list
+    while(ui->menuFolders->actions().size()>3){ //Until the only actions left are the add/remove buttons and the separator
+        //Remove the last action
+        ui->menuFolders->removeAction(ui->menuFolders->actions().at(ui->menuFolders->actions().size()-1));
+    }
 
-//    //Make the new one
-//    for(Library* misliDir: misliLibrary()->misliDirs()){
-//        QAction *action = ui->menuFolders->addAction(misliDir->folderPath);
-//        action->setCheckable(true);
-//        if(misliDir==currentDir()) action->setChecked(true);
-//    }
-//}
+    //Make the new one
+    for(Library* misliDir: misliDesktopGUI->libraries){
+        QAction *action = ui->menuFolders->addAction(misliDir->folderPath);
+        action->setCheckable(true);
+        if(misliDir==misliLibrary()) action->setChecked(true);
+    }
+    ui->actionRemove_current->setEnabled(misliDesktopGUI->libraries.size() > 1);
+}
 
 void MisliWindow::copySelectedNotesToClipboard() //It's not a lambda because it's used also in cut, and other
 {
@@ -791,8 +858,10 @@ void MisliWindow::addNewFolder()
 
     if( !path.isEmpty() ){ //if the dir is non existent or inaccessible cd returns false
         misliDesktopGUI->setOverrideCursor(Qt::WaitCursor);
-//        currentCanvas()->setCurrentDir( misliInstance()->addDir(path) );
+        Library *lib = misliDesktopGUI->addLibrary(path); //the rest of it loads in the background
+        if( (currentCanvasWidget() != nullptr) && !lib->noteFiles().isEmpty() ) currentCanvasWidget()->setNoteFile(lib->defaultNoteFile());
         misliDesktopGUI->restoreOverrideCursor();
+        updateDirListMenu();
     }
 }
 
@@ -801,6 +870,102 @@ void MisliWindow::handleNoteFilesChange()
     currentCanvasWidget()->setNoteFile(currentCanvasWidget()->currentNoteFile);
 }
 
+void MisliWindow::showScanningProgress(int foldersScanned, int noteFilesFound)
+{
+    statusBar()->showMessage(tr("Scanning folders: %1 (%2 note files)").arg(foldersScanned).arg(noteFilesFound));
+}
+void MisliWindow::showLoadingProgress(int done, int total)
+{
+    statusBar()->showMessage(tr("Loading note files: %1/%2").arg(done).arg(total));
+}
+void MisliWindow::handleLibraryLoaded()
+{
+    statusBar()->showMessage(tr("All note files are loaded."), 3000);
+
+    updateNoteFilesListMenu();
+    updateDirListMenu();
+    notes_search->handleLibraryLoaded(); //the search may have run on a partial index
+}
+void MisliWindow::handleNoteFileUnloading(NoteFile *nf) //e.g. removed from the folder by a sync tool
+{
+    for(int i=0; i<ui->tabWidget->count(); i++){
+        CanvasWidget *canvas = qobject_cast<CanvasWidget*>(ui->tabWidget->widget(i));
+        if(canvas == nullptr) continue;
+
+        if(canvas->noteFile() == nf) canvas->setNoteFile(nullptr); //switches to another one
+        if(canvas->lastNoteFile == nf) canvas->lastNoteFile = nullptr;
+    }
+    notes_search->unloadNotes(nf);
+    updateNoteFilesListMenu();
+}
+QJsonObject MisliWindow::memoryUsage() //estimated bytes, see Library::memoryUsage()
+{
+    QJsonArray librariesUsage;
+    qint64 total = 0;
+    for(Library *lib: misliDesktopGUI->libraries){
+        QJsonObject usage = lib->memoryUsage();
+        total += qint64(usage["total"].toDouble());
+        librariesUsage.append(usage);
+    }
+
+    QJsonObject usage;
+    usage["libraries"] = librariesUsage;
+    usage["clipboard"] = clipboardNoteFile->memoryUsage();
+    usage["search"] = notes_search->memoryUsage();
+    usage["undo_redo_history_all"] = NoteFile::totalHistorySize; //against UNDO_HISTORY_BUDGET
+    usage["total"] = total + qint64(usage["clipboard"].toObject()["total"].toDouble()) + notes_search->memoryUsage();
+    return usage;
+}
+void MisliWindow::showMemoryUsage()
+{
+    QJsonObject usage = memoryUsage();
+    auto megabytes = [](QJsonValue bytes){
+        return QString::number(bytes.toDouble() / 1000000, 'f', 2) + " MB";
+    };
+
+    //The totals and the biggest notefiles. The details are in the JSON dump
+    QString text = tr("Total: %1").arg(megabytes(usage["total"])) + "\n";
+    QList<QPair<double, QString>> noteFileTotals;
+    for(QJsonValue libValue: usage["libraries"].toArray()){
+        QJsonObject lib = libValue.toObject();
+        text += "\n" + lib["folder"].toString() + ": " + megabytes(lib["total"]);
+        for(QJsonValue nfValue: lib["notefiles"].toArray()){
+            QJsonObject nf = nfValue.toObject();
+            noteFileTotals.push_back(qMakePair(nf["total"].toDouble(), nf["name"].toString()));
+        }
+    }
+    text += "\n" + tr("Search: %1").arg(megabytes(usage["search"]));
+    text += "\n" + tr("Undo/redo history: %1").arg(megabytes(usage["undo_redo_history_all"])) + "\n";
+
+    std::sort(noteFileTotals.begin(), noteFileTotals.end());
+    for(int i = noteFileTotals.size() - 1; i >= qMax(0, noteFileTotals.size() - 10); i--){
+        text += "\n" + noteFileTotals[i].second + ": " + megabytes(noteFileTotals[i].first);
+    }
+
+    QMessageBox box(QMessageBox::Information, tr("Memory usage (estimated)"), text, QMessageBox::Close, this);
+    QPushButton *saveButton = box.addButton(tr("Save as JSON..."), QMessageBox::ActionRole);
+    box.exec();
+
+    if(box.clickedButton() == saveButton){
+        QString path = QFileDialog::getSaveFileName(this, tr("Save the memory usage"), "misli_memory_usage.json", "JSON (*.json)");
+        if(path.isEmpty()) return;
+
+        QFile file(path);
+        if(!file.open(QIODevice::WriteOnly)){
+            qDebug()<<"[MisliWindow::showMemoryUsage]Failed opening"<<path;
+            return;
+        }
+        file.write(QJsonDocument(usage).toJson());
+    }
+}
+void MisliWindow::showMergeConflicts(NoteFile *nf, int count)
+{
+    QMessageBox::warning(this, tr("Sync conflict"),
+                         tr("%1 notes in \"%2\" were changed both here and on another device. "
+                            "The other versions were added below them with the tag \"%3\".")
+                         .arg(count).arg(nf->name()).arg(MERGE_CONFLICT_TAG));
+}
+
 void MisliWindow::handleFoldersMenuClick(QAction *action)
 {
     //Check if the click is on the add/remove buttons
@@ -808,10 +973,13 @@ void MisliWindow::handleFoldersMenuClick(QAction *action)
         return;
     }
 
-    //Set the dir
-//    for(Library *misliDir: misliInstance()->misliDirs()){
-//            if(misliDir->folderPath==action->text()) currentCanvas()->setCurrentDir(misliDir);
-//    }
+    //Switch to the default notefile of that library
+    for(Library *misliDir: misliDesktopGUI->libraries){
+        if( (misliDir->folderPath==action->text()) && !misliDir->noteFiles().isEmpty() ){
+            currentCanvasWidget()->setNoteFile(misliDir->defaultNoteFile());
+        }
+    }
+    updateDirListMenu();
 }
 void MisliWindow::handleNoteFilesMenuClick(QAction *action)
 {
@@ -50,6 +50,7 @@ public:
     bool timelineTabIsActive();
 
     Library *misliLibrary();
+    QJsonObject memoryUsage();
     CanvasWidget *currentCanvasWidget();
 
     //GUI
@@ -78,6 +79,7 @@ public slots:
     void newNoteFile();
     void renameNoteFile();
     void deleteNoteFileFromFS();
+    void restoreNoteFileVersion();
 
     void nextNoteFile();
     void previousNoteFile();
@@ -87,7 +89,7 @@ public slots:
     void makeNoteFileDefault();
     void addNewFolder();
     void openNoteFileInNewTab(NoteFile *nf);
-//    void removeCurrentFolder();
+    void removeCurrentFolder();
 
     void updateTitle();
 
@@ -99,9 +101,15 @@ public slots:
     void zoomIn();
 
     void updateNoteFilesListMenu();
-//    void updateDirListMenu();
+    void updateDirListMenu();
 
     void handleNoteFilesChange();
+    void showScanningProgress(int foldersScanned, int noteFilesFound);
+    void showLoadingProgress(int done, int total);
+    void handleLibraryLoaded();
+    void handleNoteFileUnloading(NoteFile *nf);
+    void showMergeConflicts(NoteFile *nf, int count);
+    void showMemoryUsage();
 
     void handleFoldersMenuClick(QAction *action);
     void handleNoteFilesMenuClick(QAction *action);
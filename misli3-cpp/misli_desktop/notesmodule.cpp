@@ -7,6 +7,8 @@ NotesModule::NotesModule(Timeline *timeline_):
 {
     controlWidget = &checkbox;
     misliDir = new Library("/sync/misli",true);
+    misliDir->loadNoteFiles();
+    misliDir->parseAllNoteFiles(); //fills the time index
     loadNotes();
 }
 
@@ -14,13 +16,27 @@ void NotesModule::loadNotes()
 {
     notesForDisplay.clear();
 
-    for(NoteFile *nf: misliDir->noteFiles())
-    {
-        for (Note *nt: nf->notes){
-            if( abs( nt->timeMade.toMSecsSinceEpoch() - timeline->positionInMSecs ) < timeline->viewportSizeInMSecs/2){
-                notesForDisplay.append(nt);
-                //FIXME: adjust note size
-            }
+    qint64 from = timeline->positionInMSecs - timeline->viewportSizeInMSecs/2;
+    qint64 to = timeline->positionInMSecs + timeline->viewportSizeInMSecs/2;
+
+    QList<TimeIndex::Posting> postings = misliDir->timeIndex.madeBetween(from, to);
+
+    //Look the notes up with one pass per notefile, getNoteById() is linear
+    QHash<QString, QList<int>> idsPerNoteFile;
+    for(auto posting: postings) idsPerNoteFile[posting.first].push_back(posting.second);
+
+    QHash<QString, QHash<int, Note*>> notesPerNoteFile;
+    for(auto ids = idsPerNoteFile.constBegin(); ids != idsPerNoteFile.constEnd(); ++ids){
+        NoteFile *nf = misliDir->noteFileByName(ids.key());
+        if(nf == nullptr) continue;
+        notesPerNoteFile.insert(ids.key(), nf->notesByIds(ids.value()));
+    }
+
+    for(auto posting: postings){ //in the order of the index
+        Note *nt = notesPerNoteFile.value(posting.first).value(posting.second);
+        if(nt != nullptr){
+            notesForDisplay.append(nt);
+            //FIXME: adjust note size
         }
     }
 }
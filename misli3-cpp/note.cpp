@@ -30,6 +30,7 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QDataStream>
 
 #include "global.h"
 #include "util.h"
@@ -60,42 +61,59 @@ Note::Note(int id_, QString text)
 Note * Note::fromJsonObject(QJsonObject json)
 {
     Note * nt = new Note(json["id"].toInt() , json["text"].toString());
+    nt->updateFromJsonObject(json);
+    return nt;
+}
+void Note::updateFromJsonObject(QJsonObject json) //in place, so the selection and the drawing caches stay. Doesn't emit propertiesChanged()
+{
+    QString newText = json["text"].toString();
+    if(newText != text_m){
+        text_m = newText;
+        textForShortening = text_m;
+        checkForDefinitions();
+        delete img; //may be another picture now
+        img = nullptr;
+        emit textChanged(text_m);
+    }
 
-    nt->setRect(QRectF(json["x"].toDouble(),
+    setRect(QRectF(json["x"].toDouble(),
                 json["y"].toDouble(),
                 json["width"].toDouble(),
                 json["height"].toDouble()));
 
-    nt->fontSize = json["font_size"].toDouble();
-    nt->timeMade = QDateTime::fromString(json["t_made"].toString(), TIME_FORMAT);
-    nt->timeModified = QDateTime::fromString(json["t_mod"].toString(), TIME_FORMAT);
+    fontSize = json["font_size"].toDouble();
+    timeMade = QDateTime::fromString(json["t_made"].toString(), TIME_FORMAT);
+    timeModified = QDateTime::fromString(json["t_mod"].toString(), TIME_FORMAT);
 
     QJsonArray txt_colString = json["txt_col"].toArray();
-    nt->textColor_m.setRgbF(txt_colString[0].toDouble(),
+    textColor_m.setRgbF(txt_colString[0].toDouble(),
             txt_colString[1].toDouble(),
             txt_colString[2].toDouble(),
             txt_colString[3].toDouble());
 
     QJsonArray bg_colString = json["bg_col"].toArray();
-    nt->backgroundColor_m.setRgbF(bg_colString[0].toDouble(),
+    backgroundColor_m.setRgbF(bg_colString[0].toDouble(),
             bg_colString[1].toDouble(),
             bg_colString[2].toDouble(),
             bg_colString[3].toDouble());
 
+    //The links' geometry gets arranged by the notefile
+    outlinks.clear();
     QJsonArray links = json["links"].toArray();
     for (auto l: links){
         QJsonObject l_obj = l.toObject();
-        nt->addLink(Link::fromJsonObject(l_obj));
+        Link newLink = Link::fromJsonObject(l_obj);
+        if(!hasLink(newLink.id)) outlinks.push_back(newLink); //like addLink(), but without the signal
     }
 
+    tags.clear();
     QJsonArray tags_arr = json["tags"].toArray();
 
     for(auto tag: tags_arr){
-        nt->tags.append(tag.toString());
+        tags.append(tag.toString());
     }
 
-    nt->checkForDefinitions();
-    return nt;
+    emit visualChange();
 }
 Note * Note::fromIniString(int id_, QString iniString)
 {
@@ -169,6 +187,28 @@ Note * Note::fromIniString(int id_, QString iniString)
     nt->checkForDefinitions();
     return nt;
 }
+Note * Note::readFromStream(QDataStream &in) //the derived properties are read too instead of calling checkForDefinitions()
+{
+    Note * nt = new Note(0, QString());
+    int type;
+
+    in >> nt->id >> nt->text_m >> nt->rect_m >> nt->fontSize;
+    in >> nt->timeMade >> nt->timeModified;
+    in >> nt->textColor_m >> nt->backgroundColor_m >> nt->tags;
+    in >> type >> nt->addressString >> nt->textForShortening;
+    nt->type = NoteType(type);
+    if(nt->type == NoteType::redirecting) nt->redirectTarget = nt->addressString;
+
+    int linksCount;
+    in >> linksCount;
+    for(int i=0; i<linksCount; i++){
+        nt->outlinks.push_back(Link::readFromStream(in));
+    }
+
+    //The referenced file isn't covered by the cache validation, so re-read it
+    if(nt->type == NoteType::textFile) nt->checkTextForFileDefinition();
+    return nt;
+}
 Note::~Note()
 {
     delete img;
@@ -240,12 +280,19 @@ QRectF Note::adjustTextSize(QPainter &p)
 
 void Note::checkTextForNoteFileLink() //there's an argument , because search inits the notes out of their dir and still needs that function (the actual linking functionality is not needed then)
 {
+    bool wasRedirecting = !redirectTarget.isEmpty();
+    redirectTarget.clear();
+
     if (text_m.startsWith(QString("this_note_points_to:"))){
         addressString = q_get_text_between(text_m,':',0,200); //get text between ":" and the end
         addressString = addressString.trimmed(); //remove white spaces from both sides
         type = NoteType::redirecting;
         textForShortening = addressString;
+        redirectTarget = addressString;
     }
+
+    //The library keeps an index of the redirects by target
+    if( wasRedirecting | !redirectTarget.isEmpty() ) emit redirectTargetChanged();
 }
 void Note::checkTextForFileDefinition()
 {
@@ -505,12 +552,14 @@ void Note::changeTextAndTimestamp(QString newText)
 }
 void Note::setRect(QRectF newRect)
 {
+    QRectF oldRect = rect_m;
     rect_m.setX( round(double(newRect.x())/SNAP_GRID_INTERVAL_SIZE)*SNAP_GRID_INTERVAL_SIZE );
     rect_m.setY( round(double(newRect.y())/SNAP_GRID_INTERVAL_SIZE)*SNAP_GRID_INTERVAL_SIZE );
     double width = round(double(newRect.width())/SNAP_GRID_INTERVAL_SIZE)*SNAP_GRID_INTERVAL_SIZE;
     double height = round(double(newRect.height())/SNAP_GRID_INTERVAL_SIZE)*SNAP_GRID_INTERVAL_SIZE;
     rect_m.setWidth( std::max<double>(MIN_NOTE_A, std::min<double>(width, MAX_NOTE_A)) );
     rect_m.setHeight( std::max<double>(MIN_NOTE_A, std::min<double>(height, MAX_NOTE_A)) );
+    if(rect_m != oldRect) emit rectChanged(rect_m);
 }
 void Note::setColors(QColor newTextColor, QColor newBackgroundColor)
 {
@@ -540,6 +589,7 @@ void Note::autoSize(QPainter &painter)
     if(type==NoteType::picture){
         rect_m.setWidth(10);
         rect_m.setHeight(10);
+        emit rectChanged(rect_m);
         return;
     }
 
@@ -597,14 +647,20 @@ void Note::checkForDefinitions()
     checkTextForWebPageDefinition();
 }
 
-bool Note::addLink(Link newLink)
+bool Note::hasLink(int linkId)
 {
-    //Check if a link with that ID already exists
     for(Link &ln: outlinks){
-        if(ln.id==newLink.id){
-            return false;
+        if(ln.id==linkId){
+            return true;
         }
     }
+    return false;
+}
+bool Note::addLink(Link newLink)
+{
+    //Check if a link with that ID already exists
+    if(hasLink(newLink.id)) return false;
+
     outlinks.push_back(newLink);
     emit linksChanged();
     return true;
@@ -662,6 +718,19 @@ QJsonObject Note::toJsonObject()
     return json;
 }
 
+void Note::writeToStream(QDataStream &out)
+{
+    out << id << text_m << rect_m << fontSize;
+    out << timeMade << timeModified;
+    out << textColor_m << backgroundColor_m << tags;
+    out << int(type) << addressString << textForShortening;
+
+    out << int(outlinks.size());
+    for(Link &ln: outlinks){
+        ln.writeToStream(out);
+    }
+}
+
 QString Note::toIniString()
 {
     QString iniString;
@@ -53,7 +53,9 @@ public:
     Note(Note *nt);
     Note(int id_, QString text);
     static Note * fromJsonObject(QJsonObject json);
+    void updateFromJsonObject(QJsonObject json);
     static Note * fromIniString(int id_, QString iniString);
+    static Note * readFromStream(QDataStream &in);
     ~Note();
 
     void checkTextForNoteFileLink(); //gets called from Library only
@@ -64,6 +66,7 @@ public:
     void autoSize(QPainter &painter);
     QJsonObject toJsonObject();
     QString toIniString();
+    void writeToStream(QDataStream &out);
     QRectF textRect();
 
     //Accessing properties
@@ -96,6 +99,7 @@ public:
     QString textForShortening;
     QString textForDisplay_m; //this gets drawn in the note
     QString addressString;
+    QString redirectTarget; //the notefile name for redirecting notes, empty for the rest
 
     QPointF posBeforeMove;
 
@@ -120,6 +124,7 @@ signals:
     void propertiesChanged();
     void visualChange();
     void linksChanged();
+    void redirectTargetChanged(); //or re-checked
 
 public slots:
     //Set properties
@@ -136,6 +141,7 @@ public slots:
     void drawNote(QPainter &painter);
     void drawLink(QPainter &painter, Link &ln);
 
+    bool hasLink(int linkId);
     bool addLink(Link newLink);
     void removeLink(int linkId);
 };
@@ -18,36 +18,83 @@
 #include <QString>
 #include <QDesktopWidget>
 #include <QDebug>
+#include <QThread>
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QtMath>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QtConcurrent/QtConcurrent>
 
 #include "util.h"
 #include "note.h"
 #include "notefile.h"
 #include "global.h"
+#include "librarycache.h"
+#include "versionstore.h"
+#include "sqlstorage.h"
+#include "memoryusage.h"
 #include "misli_desktop/misliwindow.h"
 #include "misli_desktop/mislidesktopgui.h"
 
-NoteFile::NoteFile()
+QList<NoteFile*> NoteFile::allNoteFiles;
+qint64 NoteFile::totalHistorySize = 0;
+quint64 NoteFile::lastHistorySequence = 0;
+
+NoteFile::NoteFile() :
+    parseMutex(QMutex::Recursive)
 {
     saveWithRequest = false;
-    keepHistoryViaGit = false;
-    indexedForSearch = false;
+    versionStore = nullptr;
+    sqlStorage = nullptr;
 
     //Clear the variables
     lastNoteId = 0;
     isDisplayedFirstOnStartup = 0;
+    isTimelineNoteFile = false;
+    fileSize = 0;
+    fileModified = 0;
+    cache = nullptr;
+    parsedNotesHaveLinkGeometry = false;
+    isPaged = false;
+    needsPaging = false;
+    isSavingSuspended = false;
+    tileSize = PAGED_TILE_SIZE;
+    parsedTileSize = 0;
     eyeX = 0;
     eyeY = 0;
     eyeZ = INITIAL_EYE_Z;
 
     isReadable=true;
+    isLoaded=false;
+    parseError = 0;
+    isParsed = false;
+    hasSavedState = false;
+    historySize = 0;
+    allNoteFiles.push_back(this);
 
-    connect(this, &NoteFile::noteTextChanged, [=](){
-       indexedForSearch = false;
-    });
+    //Undo/redo change the notes right away, the file is written when the user stops
+    persistTimer.setSingleShot(true);
+    persistTimer.setInterval(UNDO_PERSIST_DELAY);
+    connect(&persistTimer, &QTimer::timeout, this, &NoteFile::saveLastInHistoryToFile);
+
+    //The tiles asked for on paint are loaded once it's done
+    tilesTimer.setSingleShot(true);
+    tilesTimer.setInterval(0);
+    connect(&tilesTimer, &QTimer::timeout, this, &NoteFile::loadResidentTiles);
 }
 NoteFile::~NoteFile()
 {
+    allNoteFiles.removeOne(this);
+    totalHistorySize -= historySize;
+    stopIndexingTiles();
+
     for(Note* nt:notes) delete nt;
+    for(Note* nt:parsedNotes) delete nt;
 }
 
 QString NoteFile::filePath()
@@ -63,11 +110,26 @@ QString NoteFile::filePath()
 
 QString NoteFile::name()
 {
-    QString name_ = QFileInfo(filePath()).fileName();
-    name_.chop(5);
-    return name_;
+    return name_m;
+}
+void NoteFile::setFilePath(QString newPath)
+{
+    filePath_m = newPath;
+    if(libraryFolderPath.isEmpty()){
+        name_m = QFileInfo(newPath).fileName();
+    }else{ //e.g. "projects/misli" for projects/misli.json
+        name_m = QDir(libraryFolderPath).relativeFilePath(newPath);
+    }
+    name_m.chop(5);
 }
-int NoteFile::loadFromIniString(QString fileString)
+QString NoteFile::resolveNoteFileName(QString target) //for the redirects: "./name" and "../name" are relative to this notefile's folder
+{
+    if( !target.startsWith("./") && !target.startsWith("../") ) return target; //relative to the library folder
+
+    QString folder = name().section('/', 0, -2);
+    return QDir::cleanPath(folder.isEmpty() ? target : folder + "/" + target);
+}
+int NoteFile::parseIniString(QString fileString)
 {
     fileString = fileString.replace("\r",""); //Clear the windows standart junk
     QStringList lines = fileString.split(QString("\n"),QString::SkipEmptyParts);
@@ -92,63 +154,259 @@ int NoteFile::loadFromIniString(QString fileString)
         exit(43);
     }
 
-    //Load the notes
+    //Parse the notes
     for(int i = 0; i < noteIniStrings.size(); i++){
-        loadNote(Note::fromIniString(note_ids[i].toInt(), noteIniStrings[i]));
+        parsedNotes.push_back(Note::fromIniString(note_ids[i].toInt(), noteIniStrings[i]));
     }
-
-    arrangeLinksGeometry();
     return 0;
 }
-void NoteFile::loadFromJsonString(QString jsonString)
+int NoteFile::parseJsonString(QString jsonString) //returns negative on errors, e.g. for a file a sync tool is still writing
 {
     QJsonParseError err;
     QJsonDocument doc = QJsonDocument::fromJson(jsonString.toUtf8(), &err);
 
     if(err.error != QJsonParseError::NoError){
         qDebug() << "Error parsing notefile " << filePath() << " : " << err.error;
+        return -3;
     }
 
     QJsonObject json = doc.object();
 
     isDisplayedFirstOnStartup = json["is_displayed_first_on_startup"].toBool();
 
+    //A paged notefile has only the index of the notes, they're in the tiles
+    if(json["paged"].toBool()){
+        parsedTileSize = json["tile_size"].toDouble(PAGED_TILE_SIZE);
+
+        for(auto entryValue: json["note_index"].toArray()){
+            QJsonObject entry = entryValue.toObject();
+            QRectF rect(entry["x"].toDouble(),
+                        entry["y"].toDouble(),
+                        entry["width"].toDouble(),
+                        entry["height"].toDouble());
+            parsedNoteIndex.insert(entry["id"].toInt(), PagedNoteEntry{entry["tile"].toString(), rect});
+        }
+        return 0;
+    }
+
     QJsonArray notes_arr = json["notes"].toArray();
     for(auto nt: notes_arr){
-        loadNote(Note::fromJsonObject(nt.toObject()));
+        parsedNotes.push_back(Note::fromJsonObject(nt.toObject()));
     }
-    arrangeLinksGeometry();
+    return 0;
 }
-int NoteFile::loadFromFilePath()   //returns negative on errors
+int NoteFile::readHeader()   //returns negative on errors
+{
+    QFile ntFile(filePath());
+
+    if(!ntFile.open(QIODevice::ReadOnly)){
+        qDebug()<<"[NoteFile::readHeader]Error opening notefile: " << filePath();
+        isReadable = false;
+        return -2;
+    }
+    fileSize = ntFile.size();
+    fileModified = QFileInfo(ntFile).lastModified().toMSecsSinceEpoch();
+
+    //The flags are written before the notes, so the beginning of the file is enough
+    QString head = QString::fromUtf8(ntFile.read(NOTEFILE_HEADER_PEEK_SIZE));
+    ntFile.close();
+    isReadable = true;
+
+    if(filePath().endsWith(".misl")){
+        QStringList lines = head.split("\n");
+        lines.pop_back(); //may be cut off
+        for(QString line: lines){
+            if(line.startsWith("[")) break; //the notes begin
+            if(line.startsWith("is_displayed_first_on_startup")) isDisplayedFirstOnStartup = true;
+            if(line.startsWith("is_a_timeline_note_file")) isTimelineNoteFile = true;
+        }
+    }else{
+        int keyIndex = head.indexOf("\"is_displayed_first_on_startup\"");
+        if(keyIndex != -1){
+            QString value = head.mid(keyIndex).section(':', 1).trimmed();
+            isDisplayedFirstOnStartup = value.startsWith("true");
+        }else{
+            isDisplayedFirstOnStartup = false;
+        }
+    }
+    return 0;
+}
+bool NoteFile::isUnchangedOnDisk() //the file has the contents we last read or wrote
 {
+    if(contentHash.isEmpty()) return false;
+
+    //Same as for the library cache: the size and time are enough if both match
+    QFileInfo fileInfo(filePath());
+    if( fileInfo.size() != fileSize ) return false;
+    if( fileInfo.lastModified().toMSecsSinceEpoch() == fileModified ) return true;
+
     QFile ntFile(filePath());
+    if(!ntFile.open(QIODevice::ReadOnly)) return false;
+
+    return LibraryCache::contentHash(ntFile.readAll()) == contentHash;
+}
+int NoteFile::load()   //parses the notes on first access, returns negative on errors
+{
+    if(isLoaded) return 0;
+
+    //The background loading may have parsed it already
+    parseMutex.lock();
+    bool needsParsing = !isParsed;
+    parseMutex.unlock();
+
+    if(needsParsing) parseFromFilePath();
+    return finishLoading();
+}
+int NoteFile::finishLoading()   //the GUI thread part of load()
+{
+    attachParsedNotes();
+    if(parseError == 0){
+        emit loaded(this);
+    }
+    return parseError;
+}
+int NoteFile::loadFromFilePath()   //returns negative on errors
+{
+    parseFromFilePath();
+    attachParsedNotes();
+    return parseError;
+}
+int NoteFile::parseFromFilePath()   //safe to call off the GUI thread, the notes are kept in parsedNotes until attachParsedNotes()
+{
+    QMutexLocker locker(&parseMutex);
 
     //Clear the properties
-    lastNoteId = 0;
-    for(Note *nt: notes) delete nt;
-    notes.clear();
+    for(Note *nt: parsedNotes) delete nt;
+    parsedNotes.clear();
     comment.clear();
+    parsedNotesHaveLinkGeometry = false;
+    parsedTileSize = 0;
+    parsedNoteIndex.clear();
+    needsPaging = false;
+
+    //Restore the notes from the library cache if the file hasn't changed since
+    const LibraryCache::Entry *cacheEntry = nullptr;
+    if(cache != nullptr) cacheEntry = cache->validEntry(name(), filePath());
+    if(cacheEntry != nullptr && cache->restoreNotes(cacheEntry, parsedNotes)){
+        fileSize = cacheEntry->size;
+        fileModified = QFileInfo(filePath()).lastModified().toMSecsSinceEpoch();
+        contentHash = cacheEntry->hash;
+        isDisplayedFirstOnStartup = cacheEntry->isDisplayedFirstOnStartup;
+        parsedNotesHaveLinkGeometry = true;
+    }else{
+        int err = parseFileContents();
+        if(err != 0){
+            parseError = err;
+            isParsed = true;
+            return parseError;
+        }
+    }
+
+    //Notes made on a pool thread have to be handed to the GUI thread, where they'll be connected
+    QThread *guiThread = QCoreApplication::instance()->thread();
+    if(QThread::currentThread() != guiThread){
+        for(Note *nt: parsedNotes) nt->moveToThread(guiThread);
+    }
+
+    parseError = 0;
+    isParsed = true;
+    return parseError;
+}
+int NoteFile::parseIfNotLoaded()   //for the background loading, the notefile may have been opened in the meantime
+{
+    QMutexLocker locker(&parseMutex);
+
+    if(isLoaded | isParsed) return parseError;
+    return parseFromFilePath();
+}
+int NoteFile::parseFileContents()   //returns negative on errors
+{
+    if(sqlStorage != nullptr) return parseSqlStorageContents();
+
+    QFile ntFile(filePath());
 
     //Open the file
     if(!ntFile.open(QIODevice::ReadOnly)){
         qDebug()<<"[NoteFile::init]Error opening notefile: " << filePath();
         return -2;
     }
-    //Check for abnormally large files
-    if(ntFile.size() > 10000000){
-        qDebug()<<"[NoteFile::init]Note file " << name() << " is more than 10MB.Skipping.";
-        return -3;
+    //Abnormally large files are parsed once and converted to the paged layout
+    if(ntFile.size() > PAGED_NOTEFILE_MIN_SIZE){
+        qDebug()<<"[NoteFile::init]Note file " << name() << " is more than 10MB. It will be paged.";
+        needsPaging = true;
     }
-    QString fileString = fileString.fromUtf8(ntFile.readAll().data());
+    fileSize = ntFile.size();
+    fileModified = QFileInfo(ntFile).lastModified().toMSecsSinceEpoch();
+    QByteArray fileContents = ntFile.readAll();
     ntFile.close();
+    contentHash = LibraryCache::contentHash(fileContents);
+    QString fileString = QString::fromUtf8(fileContents);
 
+    int err = 0;
     if(filePath().endsWith(".json")){
-        loadFromJsonString(fileString);
+        err = parseJsonString(fileString);
     }else if(filePath().endsWith(".misl")){
-        loadFromIniString(fileString);
+        err = parseIniString(fileString);
+    }
+    if(err != 0) return err;
+    if(parsedNotes.size() > PAGED_NOTEFILE_MIN_NOTES) needsPaging = true;
+    return 0;
+}
+int NoteFile::parseSqlStorageContents() //the notes are rows in the library's database, there's no file
+{
+    isDisplayedFirstOnStartup = sqlStorage->isDisplayedFirstOnStartup(name());
+    for(const QByteArray &state: sqlStorage->readNoteStates(name())){
+        parsedNotes.push_back(Note::fromJsonObject(QJsonDocument::fromJson(state).object()));
     }
     return 0;
 }
+void NoteFile::attachParsedNotes()   //GUI thread only
+{
+    QMutexLocker locker(&parseMutex);
+    stopIndexingTiles(); //of the replaced tiles
+
+    isParsed = false;
+    lastNoteId = 0;
+    QSet<int> changedIds;
+    for(Note *nt: notes){
+        changedIds.insert(nt->id);
+        delete nt;
+    }
+    notes.clear();
+    residentTiles.clear();
+
+    //The saved states were of the replaced notes, they're made again on the next edit
+    releaseSavedStates();
+
+    if(parseError != 0){
+        if(!changedIds.isEmpty()) emit notesChanged(this, changedIds.toList());
+        return;
+    }
+
+    //The tiles get loaded when the notefile is displayed
+    isPaged = parsedTileSize > 0;
+    if(isPaged) tileSize = parsedTileSize;
+    noteIndex.swap(parsedNoteIndex);
+    parsedNoteIndex.clear();
+
+    for(Note *nt: parsedNotes){
+        loadNote(nt);
+        changedIds.insert(nt->id);
+    }
+    parsedNotes.clear();
+    dirtyNoteIds.clear(); //loaded, not edited
+
+    if(!parsedNotesHaveLinkGeometry) arrangeLinksGeometry();
+    parsedNotesHaveLinkGeometry = false;
+    isLoaded = true;
+    if(!changedIds.isEmpty()) emit notesChanged(this, changedIds.toList()); //for the library indexes
+    if(isPaged) indexTilesOnDisk();
+
+    if(needsPaging && !isPaged){
+        needsPaging = false;
+        convertToPaged();
+    }
+}
 void NoteFile::arrangeLinksGeometry()  //init all the links in the note_file notes
 {
     for(Note *nt: notes) arrangeLinksGeometry(nt);
@@ -179,6 +437,27 @@ QString NoteFile::toJsonString()
         json["is_displayed_first_on_startup"] = true;
     }
 
+    //A paged notefile has only the index, the notes are written to the tiles
+    if(isPaged){
+        json["paged"] = true;
+        json["tile_size"] = tileSize;
+
+        QJsonArray indexEntries;
+        for(auto entry = noteIndex.constBegin(); entry != noteIndex.constEnd(); ++entry){
+            QJsonObject entryObject;
+            entryObject["id"] = entry.key();
+            entryObject["tile"] = entry->tile;
+            entryObject["x"] = entry->rect.x();
+            entryObject["y"] = entry->rect.y();
+            entryObject["width"] = entry->rect.width();
+            entryObject["height"] = entry->rect.height();
+            indexEntries.append(entryObject);
+        }
+        json["note_index"] = indexEntries;
+
+        return QJsonDocument(json).toJson();
+    }
+
     //Adding the notes
     QJsonArray noteObjects;
     for(Note *nt: notes) noteObjects.append(nt->toJsonObject());
@@ -188,61 +467,601 @@ QString NoteFile::toJsonString()
     return QJsonDocument(json).toJson();
 }
 
-void NoteFile::saveStateToHistory()
+QByteArray NoteFile::noteState(Note *nt)
 {
-    undoHistory.push_back(this->toJsonString());
+    return QJsonDocument(nt->toJsonObject()).toJson(QJsonDocument::Compact);
+}
+QList<int> NoteFile::savedNoteIdsInOrder()
+{
+    //Keep the drawing order of the notes, the ones brought back by undo go on top
+    QList<int> ids;
+    QSet<int> idsInOrder;
+    for(Note *nt: notes){
+        if(savedNoteStates.contains(nt->id)){
+            ids.push_back(nt->id);
+            idsInOrder.insert(nt->id);
+        }
+    }
+    for(int id: savedNoteStates.keys()){
+        if(!idsInOrder.contains(id)) ids.push_back(id);
+    }
+    return ids;
+}
+QJsonObject NoteFile::memoryUsage() //estimated bytes by kind, see memoryusage.h
+{
+    QMutexLocker locker(&parseMutex); //the background parsing may be filling parsedNotes
+
+    qint64 noteBytes = 0, textBytes = 0, linkBytes = 0, imageBytes = 0, stateBytes = 0, pagingBytes = 0;
+
+    for(const QList<Note*> &noteList: {notes, parsedNotes}){
+        for(Note *nt: noteList){
+            noteBytes += sizeof(Note);
+            textBytes += memorySize(nt->text_m) + memorySize(nt->textForDisplay_m) + memorySize(nt->textForShortening)
+                    + memorySize(nt->addressString) + memorySize(nt->redirectTarget) + memorySize(nt->tags);
+            for(const Link &ln: nt->outlinks){
+                linkBytes += sizeof(Link) + memorySize(ln.text) + memorySize(ln.path);
+            }
+            if(nt->img != nullptr) imageBytes += memorySize(*nt->img);
+        }
+    }
+
+    //The base states mostly share the data of the saved ones
+    stateBytes += memorySize(savedNoteStates) + memorySize(baseNoteStates);
+    for(const QByteArray &state: savedNoteStates) stateBytes += memorySize(state);
+    for(auto state = baseNoteStates.constBegin(); state != baseNoteStates.constEnd(); ++state){
+        if(state.value().constData() != savedNoteStates.value(state.key()).constData()) stateBytes += memorySize(state.value());
+    }
+
+    pagingBytes += memorySize(noteIndex) + memorySize(parsedNoteIndex);
+    for(const PagedNoteEntry &entry: noteIndex) pagingBytes += memorySize(entry.tile);
+
+    QJsonObject usage;
+    usage["name"] = name();
+    usage["notes_count"] = notes.size();
+    usage["notes"] = noteBytes;
+    usage["text"] = textBytes;
+    usage["links"] = linkBytes;
+    usage["images"] = imageBytes;
+    usage["undo_redo_history"] = historySize; //as counted for UNDO_HISTORY_BUDGET
+    usage["saved_states"] = stateBytes;
+    usage["paging_index"] = pagingBytes;
+    usage["total"] = noteBytes + textBytes + linkBytes + imageBytes + historySize + stateBytes + pagingBytes;
+    return usage;
+}
+QByteArray NoteFile::fileContents() //the last saved state, in the file format
+{
+    if(isPaged) return toJsonString().toUtf8();
+    if(!hasSavedState) initSavedStates(QSet<int>());
+
+    QList<QByteArray> noteStates;
+    for(int id: savedNoteIdsInOrder()) noteStates.push_back(savedNoteStates.value(id));
+    return jsonFileContents(noteStates, isDisplayedFirstOnStartup);
+}
+QByteArray NoteFile::jsonFileContents(const QList<QByteArray> &noteStates, bool isDisplayedFirstOnStartup)
+{
+    //The states are already serialized, so they're just joined
+    QByteArray contents = "{\n";
+    if(isDisplayedFirstOnStartup) contents += "\"is_displayed_first_on_startup\": true,\n";
+    contents += "\"notes\": [";
+    for(int i=0; i<noteStates.size(); i++){
+        if(i != 0) contents += ",";
+        contents += "\n" + noteStates[i];
+    }
+    contents += "\n]\n}\n";
+
+    return contents;
+}
+void NoteFile::applyNoteState(int id, QByteArray state)
+{
+    if(state.isEmpty()){
+        savedNoteStates.remove(id);
+    }else{
+        savedNoteStates.insert(id, state);
+    }
+}
+void NoteFile::clearRedoHistory()
+{
+    for(const HistoryStep &step: redoHistory){
+        historySize -= step.size;
+        totalHistorySize -= step.size;
+    }
     redoHistory.clear();
+}
+void NoteFile::trimHistoryToBudget() //drops the oldest undo steps of all the notefiles
+{
+    while(totalHistorySize > UNDO_HISTORY_BUDGET){
+        NoteFile *oldestNf = nullptr;
+        for(NoteFile *nf: allNoteFiles){
+            if(nf->undoHistory.isEmpty()) continue;
+            if( (oldestNf == nullptr) || (nf->undoHistory.first().sequence < oldestNf->undoHistory.first().sequence) ){
+                oldestNf = nf;
+            }
+        }
+        if(oldestNf == nullptr) return; //only redo steps are left
 
-    //Avoid a memory leak by having max undo steps
-    if(undoHistory.size()>MAX_UNDO_STEPS){
-        undoHistory.pop_front();
+        qint64 stepSize = oldestNf->undoHistory.takeFirst().size;
+        oldestNf->historySize -= stepSize;
+        totalHistorySize -= stepSize;
+
+        //Without history or a pending write the states aren't needed until the next edit
+        if( oldestNf->undoHistory.isEmpty() && oldestNf->redoHistory.isEmpty() && !oldestNf->persistTimer.isActive() ){
+            oldestNf->releaseSavedStates();
+        }
     }
 }
+void NoteFile::saveStateToHistory()
+{
+    //The canvas edits the selected notes (and links) in place, without the change signals
+    for(Note *nt: notes){
+        if(nt->isSelected()){
+            dirtyNoteIds.insert(nt->id);
+            continue;
+        }
+        for(const Link &ln: nt->outlinks){
+            if(ln.isSelected){
+                dirtyNoteIds.insert(nt->id);
+                break;
+            }
+        }
+    }
+    if(dirtyNoteIds.isEmpty()) return;
+
+    QSet<int> editedIds;
+    editedIds.swap(dirtyNoteIds);
+
+    //There's no undo for the paged notefiles (yet), the tiles are written directly
+    if(isPaged){
+        emit notesChanged(this, editedIds.toList());
+        return;
+    }
+
+    if(!hasSavedState) initSavedStates(editedIds);
+
+    //Record only the notes that changed, with what's needed to revert them
+    QHash<int, Note*> editedNotes = notesByIds(editedIds.toList());
+    HistoryStep step;
+    step.size = 0;
+    for(auto note = editedNotes.constBegin(); note != editedNotes.constEnd(); ++note){
+        QByteArray before = savedNoteStates.value(note.key());
+        QByteArray after = (note.value() == nullptr) ? QByteArray() : noteState(note.value());
+        if(before == after) continue;
+
+        step.changes.push_back(NoteChange{note.key(), before, after});
+        step.size += before.size() + after.size();
+        applyNoteState(note.key(), after);
+    }
+
+    if(step.changes.isEmpty()) return;
+    pushUndoStep(step);
+
+    QList<int> changedIds;
+    for(const NoteChange &change: step.changes) changedIds.push_back(change.id);
+    emit notesChanged(this, changedIds);
+}
+void NoteFile::initSavedStates(QSet<int> editedIds) //the base to diff against, with the states from before the edits
+{
+    //The disk has them unless it was changed since. Reading it mustn't hide that change from the merge on write
+    bool isDiskCurrent = (sqlStorage != nullptr) || isUnchangedOnDisk();
+    qint64 knownSize = fileSize, knownModified = fileModified;
+    QByteArray knownHash = contentHash;
+
+    QHash<int, QByteArray> diskStates;
+    if(readDiskNoteStates(diskStates) != 0){
+        isDiskCurrent = false;
+        diskStates.clear();
+    }
+    fileSize = knownSize;
+    fileModified = knownModified;
+    contentHash = knownHash;
+
+    savedNoteStates.clear();
+    for(Note *nt: notes){
+        if(editedIds.contains(nt->id)) continue;
+        if(isDiskCurrent && diskStates.contains(nt->id)){
+            savedNoteStates.insert(nt->id, diskStates.value(nt->id));
+        }else{
+            savedNoteStates.insert(nt->id, noteState(nt));
+        }
+    }
+    for(int id: editedIds){ //new notes have no state before
+        if(diskStates.contains(id)) savedNoteStates.insert(id, diskStates.value(id));
+    }
+
+    baseNoteStates = savedNoteStates;
+    hasSavedState = true;
+}
+void NoteFile::releaseSavedStates() //when there's no history left to diff against
+{
+    savedNoteStates.clear();
+    baseNoteStates.clear();
+    hasSavedState = false;
+}
+HistoryStep NoteFile::diffFromSavedState(const QHash<int, QByteArray> &states) //the changes from savedNoteStates to states
+{
+    HistoryStep step;
+    step.size = 0;
+    for(auto state = states.constBegin(); state != states.constEnd(); ++state){
+        QByteArray before = savedNoteStates.value(state.key());
+        if(before != state.value()){
+            step.changes.push_back(NoteChange{state.key(), before, state.value()});
+            step.size += before.size() + state.value().size();
+        }
+    }
+    for(auto state = savedNoteStates.constBegin(); state != savedNoteStates.constEnd(); ++state){
+        if(!states.contains(state.key())){ //deleted
+            step.changes.push_back(NoteChange{state.key(), state.value(), QByteArray()});
+            step.size += state.value().size();
+        }
+    }
+    return step;
+}
+void NoteFile::pushUndoStep(HistoryStep &step)
+{
+    clearRedoHistory();
+    step.sequence = ++lastHistorySequence;
+    undoHistory.push_back(step);
+    historySize += step.size;
+    totalHistorySize += step.size;
+
+    trimHistoryToBudget();
+}
 void NoteFile::saveLastInHistoryToFile()
 {
+    if(!hasSavedState && !isPaged) initSavedStates(QSet<int>()); //e.g. only a notefile flag changed
+
     if(saveWithRequest){
         emit requestingSave(this);
         return;
+    }else if(sqlStorage != nullptr){
+        //Only the rows of the notes changed since the last write
+        sqlStorage->writeNoteStates(name(), baseNoteStates, savedNoteStates, isDisplayedFirstOnStartup);
+        baseNoteStates = savedNoteStates;
+        addVersionToStore();
     }else{
+        //A synced copy may have replaced the file since it was last read. Merge it instead of overwriting it
+        if( hasSavedState && !isPaged && !contentHash.isEmpty() && QFile::exists(filePath()) && !isUnchangedOnDisk() ){
+            QHash<int, QByteArray> diskStates;
+            if(readDiskNoteStates(diskStates) != 0){ //e.g. half written. Overwriting it would lose the notes we can't see
+                qDebug()<<"[NoteFile::saveLastInHistoryToFile]Can't read the changed file, the write is retried later:"<<filePath();
+                persistTimer.start();
+                return;
+            }
+            mergeDiskNoteStates(diskStates);
+        }
+
         QFile ntFile(filePath());
         if( !ntFile.open(QIODevice::WriteOnly) ){
             qDebug()<<"[NoteFile::hardSave]Failed opening the file.";
         }
-        ntFile.write(undoHistory.back().toUtf8());
+        QByteArray contents = fileContents();
+        ntFile.write(contents);
         ntFile.close();
+
+        //Keep what's on the disk known, for the library cache
+        fileSize = contents.size();
+        fileModified = QFileInfo(ntFile).lastModified().toMSecsSinceEpoch();
+        contentHash = LibraryCache::contentHash(contents);
+        baseNoteStates = savedNoteStates;
+
+        addVersionToStore();
     }
     qDebug()<<"Note file:"<<name()<<" saved.";
 }
+void NoteFile::addVersionToStore()
+{
+    //Only the notes that aren't in the store already take space
+    if( (versionStore != nullptr) && !isPaged ){
+        QByteArrayList noteStates;
+        for(int id: savedNoteIdsInOrder()) noteStates.push_back(savedNoteStates.value(id));
+        versionStore->addVersion(name(), noteStates);
+    }
+}
 void NoteFile::save()
 {
     if(filePath()=="clipboardNoteFile") return;
 
+    //Don't overwrite the file with a notefile that hasn't been parsed yet
+    if(!isLoaded && load() != 0) return;
+
+    //Changes made while tiles are loaded or undo is applied get saved afterwards
+    if(isSavingSuspended) return;
+    persistTimer.stop(); //the write below has the latest state
+
+    if(isPaged) writeResidentTiles(); //the index goes through the history like a whole notefile
+
     saveStateToHistory();
     saveLastInHistoryToFile();
 }
 void NoteFile::undo()
 {
-    if(undoHistory.size()>=2){
-        redoHistory.push_front(undoHistory.back());
-        undoHistory.pop_back(); //pop the current version
-        saveLastInHistoryToFile();
+    if(undoHistory.isEmpty()) return;
 
-        loadFromFilePath();
-    }
+    HistoryStep step = undoHistory.takeLast();
+    applyNoteChanges(step.changes, false);
+    redoHistory.push_back(step);
+    persistTimer.start();
 }
 void NoteFile::redo()
 {
-    if(redoHistory.size()>=1){
-        undoHistory.push_back(redoHistory.front());
-        redoHistory.pop_back(); //pop the current version
-        saveLastInHistoryToFile();
+    if(redoHistory.isEmpty()) return;
 
-        loadFromFilePath();
+    HistoryStep step = redoHistory.takeLast();
+    applyNoteChanges(step.changes, true);
+    undoHistory.push_back(step);
+    persistTimer.start();
+}
+int NoteFile::restoreVersion(int index) //from the version store, can be undone like an edit
+{
+    if( (versionStore == nullptr) || isPaged ) return -1;
+    if(!isLoaded && load() != 0) return -1;
+    if(!hasSavedState) initSavedStates(QSet<int>());
+
+    QByteArrayList noteStates = versionStore->versionNoteStates(name(), index);
+    if( noteStates.isEmpty() && (versionStore->versionCount(name()) <= index) ) return -1;
+
+    QHash<int, QByteArray> versionStates;
+    for(const QByteArray &state: noteStates){
+        versionStates.insert(QJsonDocument::fromJson(state).object().value("id").toInt(), state);
+    }
+
+    //Diff against the current saved state, same as for an edit
+    HistoryStep step = diffFromSavedState(versionStates);
+    if(step.changes.isEmpty()) return 0;
+
+    applyNoteChanges(step.changes, true);
+    pushUndoStep(step);
+    persistTimer.start();
+
+    return 0;
+}
+int NoteFile::reloadFromFilePath() //for external changes: only the notes that differ are touched
+{
+    if(!isLoaded || isPaged) return loadFromFilePath();
+    if(!hasSavedState) initSavedStates(QSet<int>()); //the base to diff against
+
+    QHash<int, QByteArray> diskStates;
+    int err = readDiskNoteStates(diskStates);
+    if( (err == -4) && !persistTimer.isActive() ) return loadFromFilePath(); //paged on another machine, nothing of ours to merge
+    if(err != 0) return err; //no merge, the write waits for a readable file
+
+    //The file is written again only if our edits had to be merged in
+    if(mergeDiskNoteStates(diskStates)) persistTimer.start();
+    return 0;
+}
+int NoteFile::readDiskNoteStates(QHash<int, QByteArray> &diskStates) //returns negative on errors, then the disk stays unknown
+{
+    QMutexLocker locker(&parseMutex);
+
+    for(Note *nt: parsedNotes) delete nt;
+    parsedNotes.clear();
+    comment.clear();
+
+    qint64 knownSize = fileSize, knownModified = fileModified;
+    QByteArray knownHash = contentHash;
+    int err = parseFileContents();
+
+    //A paged copy has only the index of the notes, merging against it would delete them all
+    if( (err == 0) && (parsedTileSize > 0) ){
+        qDebug()<<"[NoteFile::readDiskNoteStates]The file on disk is paged:"<<filePath();
+        err = -4;
+    }
+    parsedTileSize = 0;
+    parsedNoteIndex.clear();
+
+    if(err != 0){
+        for(Note *nt: parsedNotes) delete nt;
+        parsedNotes.clear();
+        fileSize = knownSize;
+        fileModified = knownModified;
+        contentHash = knownHash;
+        return err;
+    }
+
+    for(Note *nt: parsedNotes){
+        diskStates.insert(nt->id, noteState(nt));
+        delete nt;
+    }
+    parsedNotes.clear();
+    return 0;
+}
+
+//Three-way merge of a JSON value, on a conflict ours stays
+static QJsonValue mergeJsonValues(const QJsonValue &base, const QJsonValue &ours, const QJsonValue &theirs, bool &isConflict)
+{
+    if(ours == theirs) return ours;
+    if(ours == base) return theirs;
+    if(theirs == base) return ours;
+    isConflict = true;
+    return ours;
+}
+static QJsonArray mergeLinks(const QJsonArray &base, const QJsonArray &ours, const QJsonArray &theirs, bool &isConflict) //by target id
+{
+    QHash<int, QJsonValue> baseLinks, ourLinks, theirLinks;
+    QList<int> ids;
+    for(QJsonValue ln: base) baseLinks.insert(ln.toObject()["to_id"].toInt(), ln);
+    for(QJsonValue ln: ours){
+        ourLinks.insert(ln.toObject()["to_id"].toInt(), ln);
+        ids.push_back(ln.toObject()["to_id"].toInt());
+    }
+    for(QJsonValue ln: theirs){
+        theirLinks.insert(ln.toObject()["to_id"].toInt(), ln);
+        if(!ourLinks.contains(ln.toObject()["to_id"].toInt())) ids.push_back(ln.toObject()["to_id"].toInt());
+    }
+
+    QJsonArray merged;
+    for(int id: ids){
+        QJsonValue ln = mergeJsonValues(baseLinks.value(id), ourLinks.value(id), theirLinks.value(id), isConflict);
+        if(!ln.isNull()) merged.append(ln); //null if removed
+    }
+    return merged;
+}
+static QByteArray mergeNoteStates(const QByteArray &base, const QByteArray &ours, const QByteArray &theirs, bool &isConflict) //property by property
+{
+    QJsonObject baseJson = QJsonDocument::fromJson(base).object();
+    QJsonObject ourJson = QJsonDocument::fromJson(ours).object();
+    QJsonObject theirJson = QJsonDocument::fromJson(theirs).object();
+    QJsonObject merged = ourJson;
+
+    QStringList keys = ourJson.keys() + theirJson.keys();
+    keys.removeDuplicates();
+    for(QString key: keys){
+        if(key == "links"){
+            merged[key] = mergeLinks(baseJson.value(key).toArray(), ourJson.value(key).toArray(), theirJson.value(key).toArray(), isConflict);
+        }else if(key == "t_mod"){ //both sides set it on every edit, the later one is kept
+            QDateTime ourTime = QDateTime::fromString(ourJson.value(key).toString(), TIME_FORMAT);
+            QDateTime theirTime = QDateTime::fromString(theirJson.value(key).toString(), TIME_FORMAT);
+            merged[key] = (theirTime > ourTime) ? theirJson.value(key) : ourJson.value(key);
+        }else{
+            merged[key] = mergeJsonValues(baseJson.value(key), ourJson.value(key), theirJson.value(key), isConflict);
+        }
+    }
+    return QJsonDocument(merged).toJson(QJsonDocument::Compact);
+}
+static QByteArray mergeNote(const QByteArray &base, const QByteArray &ours, const QByteArray &theirs, bool &isConflict) //empty states for the missing notes
+{
+    if(ours == theirs) return ours;
+    if(ours == base) return theirs;
+    if(theirs == base) return ours;
+    if( ours.isEmpty() | theirs.isEmpty() ) return ours.isEmpty() ? theirs : ours; //deleted on one side, edited on the other - the edit stays
+    return mergeNoteStates(base, ours, theirs, isConflict);
+}
+
+bool NoteFile::mergeDiskNoteStates(const QHash<int, QByteArray> &diskStates) //returns true if the result differs from the disk
+{
+    //Base: what was last read or written, ours: savedNoteStates, theirs: the disk
+    QHash<int, QByteArray> mergedStates;
+    QList<QByteArray> conflictingStates;
+
+    QList<int> ids = baseNoteStates.keys() + savedNoteStates.keys() + diskStates.keys();
+    int maxId = lastNoteId;
+    for(int id: ids.toSet()){
+        QByteArray base = baseNoteStates.value(id);
+        QByteArray ours = savedNoteStates.value(id);
+        QByteArray theirs = diskStates.value(id);
+        maxId = qMax(maxId, id);
+
+        bool isConflict = false;
+        QByteArray merged = mergeNote(base, ours, theirs, isConflict);
+        if(isConflict) conflictingStates.push_back(theirs);
+        if(!merged.isEmpty()) mergedStates.insert(id, merged);
+    }
+
+    //On a conflict our version stays, and theirs is added under it as a new note to be resolved by hand
+    for(const QByteArray &state: conflictingStates){
+        QJsonObject json = QJsonDocument::fromJson(state).object();
+        json["id"] = ++maxId;
+        json["y"] = json["y"].toDouble() + json["height"].toDouble() + NOTE_SPACING;
+        QJsonArray tags = json["tags"].toArray();
+        tags.append(QString(MERGE_CONFLICT_TAG));
+        json["tags"] = tags;
+        mergedStates.insert(maxId, QJsonDocument(json).toJson(QJsonDocument::Compact));
+    }
+
+    //The synced changes aren't ours to undo. They go under the history, so undoing or redoing our edits keeps them.
+    //A write after an undo gets here too, so the redo steps have to stay
+    QSet<int> externalIds;
+    for(int id: ids.toSet()){
+        if(diskStates.value(id) != baseNoteStates.value(id)) externalIds.insert(id);
+    }
+    rebaseHistory(undoHistory, diskStates, externalIds);
+    rebaseHistory(redoHistory, diskStates, externalIds);
+
+    HistoryStep step = diffFromSavedState(mergedStates);
+    if(!step.changes.isEmpty()) applyNoteChanges(step.changes, true);
+    baseNoteStates = diskStates;
+
+    if(!conflictingStates.isEmpty()){
+        qDebug()<<"[NoteFile::mergeDiskNoteStates]"<<conflictingStates.size()<<"conflicting notes in"<<name();
+        emit mergeConflicts(this, conflictingStates.size());
+    }
+    return mergedStates != diskStates;
+}
+void NoteFile::rebaseHistory(QList<HistoryStep> &history, const QHash<int, QByteArray> &diskStates, const QSet<int> &externalIds) //as if the disk changes were made before the steps
+{
+    if(externalIds.isEmpty()) return;
+
+    QMutableListIterator<HistoryStep> stepIterator(history);
+    while(stepIterator.hasNext()){
+        HistoryStep &step = stepIterator.next();
+        qint64 oldSize = step.size;
+        step.size = 0;
+
+        QMutableListIterator<NoteChange> changeIterator(step.changes);
+        while(changeIterator.hasNext()){
+            NoteChange &change = changeIterator.next();
+            if(externalIds.contains(change.id)){
+                QByteArray base = baseNoteStates.value(change.id), theirs = diskStates.value(change.id);
+                bool isConflict = false; //ours stays, the conflict copy is made for the current state only
+                change.before = mergeNote(base, change.before, theirs, isConflict);
+                change.after = mergeNote(base, change.after, theirs, isConflict);
+                if(change.before == change.after){
+                    changeIterator.remove();
+                    continue;
+                }
+            }
+            step.size += change.before.size() + change.after.size();
+        }
+
+        historySize += step.size - oldSize;
+        totalHistorySize += step.size - oldSize;
+        if(step.changes.isEmpty()) stepIterator.remove();
+    }
+}
+void NoteFile::applyNoteChanges(const QList<NoteChange> &changes, bool redoing) //in memory, only the changed notes are touched
+{
+    QSet<int> changedIds;
+    if(!hasSavedState) initSavedStates(QSet<int>()); //the states follow the changes below
+
+    for(const NoteChange &change: changes){
+        QByteArray state = redoing ? change.after : change.before;
+        applyNoteState(change.id, state); //the saved state follows
+        changedIds.insert(change.id);
+
+        Note *nt = getNoteById(change.id);
+        if(state.isEmpty()){
+            if(nt != nullptr){
+                notes.removeOne(nt);
+                delete nt;
+            }
+            continue;
+        }
+
+        QJsonObject json = QJsonDocument::fromJson(state).object();
+        if(nt != nullptr){
+            nt->updateFromJsonObject(json);
+        }else{
+            loadNote(Note::fromJsonObject(json));
+        }
+    }
+
+    //Relayout the links of the changed notes and of the ones pointing to them
+    isSavingSuspended = true;
+    for(Note *nt: notes){
+        bool isAffected = changedIds.contains(nt->id);
+        for(Link &ln: nt->outlinks){
+            if(changedIds.contains(ln.id)) isAffected = true;
+        }
+        if(isAffected) arrangeLinksGeometry(nt);
+    }
+    isSavingSuspended = false;
+
+    dirtyNoteIds.subtract(changedIds); //their states are applied already
+
+    emit notesChanged(this, changedIds.toList());
+    emit noteTextChanged(this);
+    emit visualChange();
+}
+void NoteFile::flushPendingWrite()
+{
+    if(persistTimer.isActive()){
+        persistTimer.stop();
+        saveLastInHistoryToFile();
     }
 }
 
 void NoteFile::addNote(Note* nt)
 {
+    load();
     loadNote(nt);
     save();
     emit visualChange();
@@ -255,14 +1074,30 @@ Note* NoteFile::loadNote(Note *nt)
     }
 
     notes.push_back(nt);
+    dirtyNoteIds.insert(nt->id); //cleared for the ones that are only being loaded
 
-    //Connections
+    //Connections (the save has to come after the marking)
+    auto markDirty = [=](){
+        dirtyNoteIds.insert(nt->id);
+    };
+    connect(nt,&Note::propertiesChanged,markDirty);
+    connect(nt,&Note::textChanged,markDirty);
+    connect(nt,&Note::rectChanged,markDirty);
+    connect(nt,&Note::linksChanged,markDirty);
     connect(nt,SIGNAL(propertiesChanged()),this,SLOT(save()));
     connect(nt,SIGNAL(visualChange()),this,SIGNAL(visualChange()));
     connect(nt,SIGNAL(linksChanged()),this,SLOT(arrangeLinksGeometry()));
     connect(nt,&Note::textChanged,[=](){
         emit noteTextChanged(this);
     });
+    connect(nt,&Note::redirectTargetChanged,[=](){
+        if(!nt->redirectTarget.isEmpty()) nt->redirectTarget = resolveNoteFileName(nt->addressString);
+        emit redirectTargetChanged(nt);
+    });
+    if(!nt->redirectTarget.isEmpty()){ //parsed before it was connected
+        nt->redirectTarget = resolveNoteFileName(nt->addressString);
+        emit redirectTargetChanged(nt);
+    }
     return nt;
 }
 Note *NoteFile::cloneNote(Note *nt)
@@ -278,7 +1113,9 @@ void NoteFile::deleteSelected() //deletes all marked selected and returns their
     while(getFirstSelectedNote()!=nullptr){ //delete selected notes
         deletedItemsCount++;
         Note *nt = getFirstSelectedNote();
+        dirtyNoteIds.insert(nt->id);
         notes.removeOne(nt);
+        noteIndex.remove(nt->id);
         delete nt;
     }
     //Remove all selected links
@@ -287,6 +1124,7 @@ void NoteFile::deleteSelected() //deletes all marked selected and returns their
         while(linkIter.hasNext()){
             if(linkIter.next().isSelected){
                 deletedItemsCount++;
+                dirtyNoteIds.insert(nt->id);
                 linkIter.remove();
             }
         }
@@ -320,11 +1158,36 @@ Note *NoteFile::getLowestIdNote()
 }
 Note *NoteFile::getNoteById(int id) //returns the note with the given id
 {
+    if(!notesByIdWhileLoading.isEmpty()) return notesByIdWhileLoading.value(id, nullptr);
+
     for(Note *nt: notes){
         if( nt->id==id ){return nt;} //ako id-to syvpada vyrni pointera kym toq note
     }
     return nullptr;
 }
+QHash<int, Note*> NoteFile::notesByIds(QList<int> ids) //in one pass over the notes, nullptr for the ones that don't exist
+{
+    QHash<int, Note*> found;
+    found.reserve(ids.size());
+    for(int id: ids) found.insert(id, nullptr);
+
+    for(Note *nt: notes){
+        auto entry = found.find(nt->id);
+        if(entry != found.end()) entry.value() = nt;
+    }
+    return found;
+}
+bool NoteFile::noteExists(int id) //also the ones in the tiles that aren't loaded
+{
+    return (getNoteById(id) != nullptr) || noteIndex.contains(id);
+}
+QRectF NoteFile::noteRectById(int id)
+{
+    Note *nt = getNoteById(id);
+    if(nt != nullptr) return nt->rect();
+
+    return noteIndex.value(id).rect;
+}
 void NoteFile::selectAllNotes()
 {
     for(Note *nt: notes) nt->setSelected(true);
@@ -366,7 +1229,7 @@ void NoteFile::makeAllIDsNegative()
 int NoteFile::getNewId()
 {
     for(int i=1;i<65535;i++){
-        if(getNoteById(i)==nullptr){
+        if(!noteExists(i)){
             return i;
         }
     }
@@ -389,10 +1252,10 @@ void NoteFile::arrangeLinksGeometry(Note *nt) //smqta koordinatite
 
     for(Link &ln: nt->outlinks){
         //---------Smqtane na koordinatite za link-a---------------
-        Note *target_note = getNoteById(ln.id);
+        QRectF targetRect = noteRectById(ln.id); //the target may be in a tile that isn't loaded
 
         //Setup the rectangles to check if they intersect
-        QRectF note1 = nt->rect(), note2 = target_note->rect();
+        QRectF note1 = nt->rect(), note2 = targetRect;
         note1.moveTop(0);
         note2.moveTop(0);
         note1.setHeight(1);
@@ -401,27 +1264,27 @@ void NoteFile::arrangeLinksGeometry(Note *nt) //smqta koordinatite
         //Construct the line as it would be without a control point (stored as autoLine)
         if(note1.intersects(note2)){ //If the notes are one above another
             //Check which one is above the other
-            if(nt->rect().center().y() > target_note->rect().center().y()){ //Note1 is below
+            if(nt->rect().center().y() > targetRect.center().y()){ //Note1 is below
                 ln.autoLine.setLine(nt->rect().center().x(),
                                 nt->rect().y(),
-                                target_note->rect().center().x(),
-                                target_note->rect().bottom());
+                                targetRect.center().x(),
+                                targetRect.bottom());
             }else{//Note1 is above
                 ln.autoLine.setLine(nt->rect().center().x(),
                                 nt->rect().bottom(),
-                                target_note->rect().center().x(),
-                                target_note->rect().y());
+                                targetRect.center().x(),
+                                targetRect.y());
             }
         }else if(note1.right()<note2.x()){ //If the second note is on the right
             ln.autoLine.setLine(nt->rect().right(),
                             nt->rect().center().y(),
-                            target_note->rect().left(),
-                            target_note->rect().center().y());
+                            targetRect.left(),
+                            targetRect.center().y());
         }else{ //If the second note is on the left
             ln.autoLine.setLine(nt->rect().left(),
                             nt->rect().center().y(),
-                            target_note->rect().right(),
-                            target_note->rect().center().y());
+                            targetRect.right(),
+                            targetRect.center().y());
         }
 
         //Set the control point if it hasn't been
@@ -475,19 +1338,19 @@ void NoteFile::arrangeLinksGeometry(Note *nt) //smqta koordinatite
             //Set P2 of the line
             if(note2.intersects(controlRect)){ //If the notes are one above another
                 //Check which one is above the other
-                if(controlP.y() > target_note->rect().center().y()){ //The control point is below note2
-                    ln.line.setP2(QPointF(target_note->rect().center().x(),
-                                          target_note->rect().bottom()));
+                if(controlP.y() > targetRect.center().y()){ //The control point is below note2
+                    ln.line.setP2(QPointF(targetRect.center().x(),
+                                          targetRect.bottom()));
                 }else{//The control point is above
-                    ln.line.setP2(QPointF(target_note->rect().center().x(),
-                                          target_note->rect().y()));
+                    ln.line.setP2(QPointF(targetRect.center().x(),
+                                          targetRect.y()));
                 }
             }else if(controlP.x()<note2.x()){ //If the control point is on the left
-                ln.line.setP2(QPointF(target_note->rect().left(),
-                                target_note->rect().center().y()));
+                ln.line.setP2(QPointF(targetRect.left(),
+                                targetRect.center().y()));
             }else{ //If the control point is on the right
-                ln.line.setP2(QPointF(target_note->rect().right(),
-                                      target_note->rect().center().y()));
+                ln.line.setP2(QPointF(targetRect.right(),
+                                      targetRect.center().y()));
             }
         }else{
             ln.line = ln.autoLine;
@@ -506,7 +1369,7 @@ void NoteFile::setPathAndLoad(QString newPath)
 
     if(QFileInfo(newPath).isReadable()){
         isReadable = true;
-        filePath_m = newPath;
+        setFilePath(newPath);
         loadFromFilePath();
     }else{
         qDebug()<<"[NoteFile::setFilePath]File not readable:"<<newPath;
@@ -520,10 +1383,304 @@ void NoteFile::checkForInvalidLinks(Note *nt)
 
     while(iterator.hasNext()){
         Link ln = iterator.next();
-        if(getNoteById(ln.id)==nullptr){ //if there's no note with the specified link id
+        if(!noteExists(ln.id)){ //if there's no note with the specified link id
             nt->removeLink(ln.id);
             linksChangedHere = true;
         }
     }
     if(linksChangedHere) save();
 }
+
+QString NoteFile::tilesFolderPath()
+{
+    QString path = filePath();
+    path.chop(5);
+    return path + ".tiles";
+}
+QString NoteFile::tileFilePath(QString tile)
+{
+    return QDir(tilesFolderPath()).filePath(tile + ".json");
+}
+QString NoteFile::tileForRect(QRectF rect) //by the top left corner, as "x_y" in tiles
+{
+    int x = qFloor(rect.x() / tileSize);
+    int y = qFloor(rect.y() / tileSize);
+    return QString::number(x) + "_" + QString::number(y);
+}
+QRectF NoteFile::tileRect(QString tile)
+{
+    QStringList coords = tile.split("_");
+    if(coords.size() != 2) return QRectF();
+
+    return QRectF(coords[0].toInt() * tileSize, coords[1].toInt() * tileSize, tileSize, tileSize);
+}
+int NoteFile::convertToPaged()
+{
+    //Keep the original around, like with the .misl conversion
+    QString backupPath = filePath() + ".backup";
+    if(QFile::exists(backupPath)) QFile::remove(backupPath);
+    QFile::copy(filePath(), backupPath);
+
+    isPaged = true;
+    tileSize = PAGED_TILE_SIZE;
+    noteIndex.clear();
+    for(Note *nt: notes) residentTiles.insert(tileForRect(nt->rect()));
+
+    save(); //writes all the tiles and the index
+
+    evictTiles(residentTiles);
+    qDebug()<<"[NoteFile::convertToPaged]Note file" << name() << "is now paged in" << tilesFolderPath();
+
+    emit visualChange();
+    return 0;
+}
+void NoteFile::updateResidentTiles(QRectF windowFrame) //called on paint for the paged notefiles, the tiles get loaded after it
+{
+    if(!isPaged) return;
+
+    requestedTilesFrame = windowFrame;
+    if(!tilesTimer.isActive()) tilesTimer.start();
+}
+void NoteFile::loadResidentTiles() //a few tiles per pass, nearest to the center first, so the GUI doesn't freeze
+{
+    if(!isPaged) return;
+
+    QRectF windowFrame = requestedTilesFrame;
+
+    //Load the visible tiles with a margin, evict the ones past one more tile (so panning back and forth doesn't thrash)
+    QRectF loadFrame = windowFrame.adjusted(-tileSize*PAGED_TILES_MARGIN, -tileSize*PAGED_TILES_MARGIN,
+                                            tileSize*PAGED_TILES_MARGIN, tileSize*PAGED_TILES_MARGIN);
+    QRectF keepFrame = loadFrame.adjusted(-tileSize, -tileSize, tileSize, tileSize);
+
+    int left = qFloor(loadFrame.left() / tileSize), right = qFloor(loadFrame.right() / tileSize);
+    int top = qFloor(loadFrame.top() / tileSize), bottom = qFloor(loadFrame.bottom() / tileSize);
+
+    //When zoomed out too far only the tiles around the center are loaded
+    int maxSide = qFloor(qSqrt(PAGED_MAX_RESIDENT_TILES));
+    if( (right - left + 1) > maxSide ){
+        left = qFloor(windowFrame.center().x() / tileSize) - maxSide/2;
+        right = left + maxSide - 1;
+    }
+    if( (bottom - top + 1) > maxSide ){
+        top = qFloor(windowFrame.center().y() / tileSize) - maxSide/2;
+        bottom = top + maxSide - 1;
+    }
+
+    QSet<QString> tilesToEvict;
+    for(const QString &tile: residentTiles){
+        if(!tileRect(tile).intersects(keepFrame)) tilesToEvict.insert(tile);
+    }
+    evictTiles(tilesToEvict);
+
+    QList<QPair<double, QString>> missingTiles; //by the distance to the center
+    for(int x = left; x <= right; x++){
+        for(int y = top; y <= bottom; y++){
+            QString tile = QString::number(x) + "_" + QString::number(y);
+            if(residentTiles.contains(tile)) continue;
+            double distance = QLineF(tileRect(tile).center(), windowFrame.center()).length();
+            missingTiles.push_back(qMakePair(distance, tile));
+        }
+    }
+    std::sort(missingTiles.begin(), missingTiles.end());
+
+    QSet<int> residentIds;
+    for(Note *nt: notes) residentIds.insert(nt->id);
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    QList<Note*> tileNotes;
+    int loadedTiles = 0;
+    for(const auto &missingTile: missingTiles){
+        if(elapsed.elapsed() >= PAGED_TILES_LOAD_BUDGET) break;
+        tileNotes.append(attachTile(missingTile.second, residentIds));
+        loadedTiles++;
+    }
+    finishLoadingTiles(tileNotes);
+
+    if(loadedTiles < missingTiles.size()) tilesTimer.start(); //the rest after the pending events
+    if(!tilesToEvict.isEmpty() || loadedTiles > 0) emit visualChange();
+}
+QList<Note*> NoteFile::attachTile(QString tile, QSet<int> &residentIds) //finishLoadingTiles() has to follow
+{
+    residentTiles.insert(tile);
+
+    QList<Note*> readNotes;
+    if(readTileFile(tileFilePath(tile), readNotes) != 0) return QList<Note*>();
+
+    QList<Note*> tileNotes;
+    for(Note *nt: readNotes){
+        if(residentIds.contains(nt->id)){ //moved here, but the old tile is loaded too
+            delete nt;
+            continue;
+        }
+        tileNotes.push_back(loadNote(nt));
+        residentIds.insert(nt->id);
+    }
+    return tileNotes;
+}
+void NoteFile::finishLoadingTiles(QList<Note*> tileNotes) //once for all the tiles attached in a pass
+{
+    if(tileNotes.isEmpty()) return;
+
+    QSet<int> tileNoteIds;
+    for(Note *nt: tileNotes) tileNoteIds.insert(nt->id);
+    dirtyNoteIds.subtract(tileNoteIds); //loaded, not edited
+
+    //The links to the new notes had the index geometry, now they get the real one
+    for(Note *nt: notes) notesByIdWhileLoading.insert(nt->id, nt);
+    isSavingSuspended = true; //no saves for the link checks
+    for(Note *nt: notes){
+        bool isAffected = tileNoteIds.contains(nt->id);
+        for(Link &ln: nt->outlinks){
+            if(tileNoteIds.contains(ln.id)) isAffected = true;
+        }
+        if(isAffected) arrangeLinksGeometry(nt);
+    }
+    isSavingSuspended = false;
+    notesByIdWhileLoading.clear();
+
+    emit notesChanged(this, tileNoteIds.toList()); //only the loaded ones get indexed again
+}
+int NoteFile::readTileFile(QString path, QList<Note*> &tileNotes) //safe to call off the GUI thread, returns negative on errors
+{
+    QFile tileFile(path);
+    if(!tileFile.open(QIODevice::ReadOnly)) return 0; //empty tiles have no file
+
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(tileFile.readAll(), &err);
+    tileFile.close();
+
+    if(err.error != QJsonParseError::NoError){
+        qDebug() << "[NoteFile::readTileFile]Error parsing tile " << path << " : " << err.error;
+        return -1;
+    }
+
+    for(auto noteValue: doc.object()["notes"].toArray()){
+        tileNotes.push_back(Note::fromJsonObject(noteValue.toObject()));
+    }
+    return 0;
+}
+
+void NoteFile::evictTiles(QSet<QString> tiles) //all changes are saved as they're made, so the notes are just dropped
+{
+    if(tiles.isEmpty()) return;
+    residentTiles.subtract(tiles);
+
+    //The indexes keep the evicted notes, as they are on disk
+    QMutableListIterator<Note*> noteIterator(notes);
+    while(noteIterator.hasNext()){
+        Note *nt = noteIterator.next();
+        QString tile = tileForRect(nt->rect());
+        if(tiles.contains(tile)){
+            noteIndex.insert(nt->id, PagedNoteEntry{tile, nt->rect()});
+            dirtyNoteIds.remove(nt->id); //not deleted, only dropped from memory
+            noteIterator.remove();
+            delete nt;
+        }
+    }
+}
+void NoteFile::indexTilesOnDisk() //the notes that aren't loaded are searchable too
+{
+    stopIndexingTiles();
+
+    QSet<QString> tiles;
+    for(const PagedNoteEntry &entry: noteIndex) tiles.insert(entry.tile);
+    for(const QString &tile: tiles) tileFilesToIndex.push_back(tileFilePath(tile));
+
+    tilesIndexing = QtConcurrent::map(tileFilesToIndex, [this](const QString &path){
+        QList<Note*> tileNotes;
+        readTileFile(path, tileNotes);
+        if(tileNotes.isEmpty()) return;
+
+        for(Note *nt: tileNotes) nt->moveToThread(QCoreApplication::instance()->thread());
+        QMutexLocker locker(&tilesIndexingMutex);
+        notesReadForIndex.append(tileNotes);
+        QMetaObject::invokeMethod(this, "handleTileNotesRead", Qt::QueuedConnection);
+    });
+}
+void NoteFile::stopIndexingTiles()
+{
+    tilesIndexing.cancel();
+    tilesIndexing.waitForFinished();
+    tileFilesToIndex.clear();
+
+    QMutexLocker locker(&tilesIndexingMutex);
+    for(Note *nt: notesReadForIndex) delete nt;
+    notesReadForIndex.clear();
+}
+void NoteFile::handleTileNotesRead()
+{
+    QList<Note*> readNotes;
+    {
+        QMutexLocker locker(&tilesIndexingMutex);
+        readNotes.swap(notesReadForIndex);
+    }
+    if(readNotes.isEmpty()) return; //taken by an earlier call
+
+    QSet<int> residentIds;
+    for(Note *nt: notes) residentIds.insert(nt->id);
+
+    QHash<int, Note*> tileNotes;
+    for(Note *nt: readNotes){
+        if(residentIds.contains(nt->id)) continue; //indexed when it was loaded
+        if(!nt->redirectTarget.isEmpty()) nt->redirectTarget = resolveNoteFileName(nt->addressString);
+        tileNotes.insert(nt->id, nt);
+    }
+    if(!tileNotes.isEmpty()) emit tileNotesRead(this, tileNotes);
+
+    for(Note *nt: readNotes) delete nt;
+}
+int NoteFile::writeResidentTiles()
+{
+    //A note moved to a tile that isn't loaded brings the tile in, so it gets written whole
+    QSet<QString> tilesToLoad;
+    for(Note *nt: notes){
+        QString tile = tileForRect(nt->rect());
+        if(!residentTiles.contains(tile)) tilesToLoad.insert(tile);
+    }
+    if(!tilesToLoad.isEmpty()){
+        QSet<int> residentIds;
+        for(Note *nt: notes) residentIds.insert(nt->id);
+
+        QList<Note*> tileNotes;
+        for(const QString &tile: tilesToLoad) tileNotes.append(attachTile(tile, residentIds));
+        finishLoadingTiles(tileNotes);
+    }
+
+    QHash<QString, QJsonArray> noteObjectsByTile;
+    for(QString tile: residentTiles) noteObjectsByTile.insert(tile, QJsonArray()); //emptied tiles get removed
+
+    for(Note *nt: notes){
+        QString tile = tileForRect(nt->rect());
+        noteObjectsByTile[tile].append(nt->toJsonObject());
+        noteIndex.insert(nt->id, PagedNoteEntry{tile, nt->rect()});
+    }
+
+    if(!QDir().mkpath(tilesFolderPath())){
+        qDebug()<<"[NoteFile::writeResidentTiles]Failed making the tiles folder:"<<tilesFolderPath();
+        return -1;
+    }
+
+    int err = 0;
+    for(auto tileNotes = noteObjectsByTile.constBegin(); tileNotes != noteObjectsByTile.constEnd(); ++tileNotes){
+        QString tilePath = tileFilePath(tileNotes.key());
+
+        if(tileNotes->isEmpty()){
+            QFile::remove(tilePath);
+            continue;
+        }
+
+        QJsonObject json;
+        json["notes"] = tileNotes.value();
+
+        QFile tileFile(tilePath);
+        if(!tileFile.open(QIODevice::WriteOnly)){
+            qDebug()<<"[NoteFile::writeResidentTiles]Failed opening the tile file:"<<tilePath;
+            err = -1;
+            continue;
+        }
+        tileFile.write(QJsonDocument(json).toJson());
+        tileFile.close();
+    }
+    return err;
+}
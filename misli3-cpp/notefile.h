@@ -20,8 +20,31 @@
 #include "note.h"
 #include "util.h"
 #include <QObject>
+#include <QMutex>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QFuture>
 
 class Library;
+class LibraryCache;
+class VersionStore;
+class SqlStorage;
+
+struct NoteChange{ //a note's state before and after a change, as compact JSON (empty if the note didn't exist)
+    int id;
+    QByteArray before, after;
+};
+struct HistoryStep{ //the notes changed by one save
+    QList<NoteChange> changes;
+    qint64 size; //bytes
+    quint64 sequence; //the order of the steps across all the notefiles
+};
+
+struct PagedNoteEntry{ //where a note of a paged notefile is, also while its tile isn't loaded
+    QString tile;
+    QRectF rect;
+};
 
 class NoteFile : public QObject
 {
@@ -35,13 +58,18 @@ public:
     ~NoteFile();
 
     QString name();
+    void setFilePath(QString newPath);
+    QString resolveNoteFileName(QString target);
     Note *getFirstSelectedNote();
     Note *getLowestIdNote();
     Note *getNoteById(int id);
+    QHash<int, Note*> notesByIds(QList<int> ids);
     void selectAllNotes();
     void clearNoteSelection();
     void clearLinkSelection();
     int linkSelectedNotesTo(Note *nt);
+    bool noteExists(int id);
+    QRectF noteRectById(int id);
     void arrangeLinksGeometry(Note *nt);
     void checkForInvalidLinks(Note *nt);
 
@@ -54,34 +82,119 @@ public:
     Note *cloneNote(Note* nt);
     void deleteSelected();
 
+    int readHeader();
+    int load();
+    int finishLoading();
     int loadFromFilePath();
-    int loadFromIniString(QString fileString);
-    void loadFromJsonString(QString jsonString);
+    int reloadFromFilePath();
+    int readDiskNoteStates(QHash<int, QByteArray> &diskStates);
+    bool mergeDiskNoteStates(const QHash<int, QByteArray> &diskStates);
+    int parseFromFilePath();
+    int parseIfNotLoaded();
+    int parseFileContents();
+    int parseSqlStorageContents();
+    void attachParsedNotes();
+    int parseIniString(QString fileString);
+    int parseJsonString(QString jsonString);
     bool loadFileAsJson();
     QString toIniString();
     QString toJsonString();
 
+    //Paged layout
+    QString tilesFolderPath();
+    QString tileFilePath(QString tile);
+    QString tileForRect(QRectF rect);
+    QRectF tileRect(QString tile);
+    int convertToPaged();
+    void updateResidentTiles(QRectF windowFrame);
+    void loadResidentTiles();
+    QList<Note*> attachTile(QString tile, QSet<int> &residentIds);
+    void finishLoadingTiles(QList<Note*> tileNotes);
+    void evictTiles(QSet<QString> tiles);
+    int writeResidentTiles();
+    static int readTileFile(QString path, QList<Note*> &tileNotes);
+    void indexTilesOnDisk();
+    void stopIndexingTiles();
+    bool isUnchangedOnDisk();
+
+    QByteArray noteState(Note *nt);
+    QList<int> savedNoteIdsInOrder();
+    QJsonObject memoryUsage();
+    QByteArray fileContents();
+    static QByteArray jsonFileContents(const QList<QByteArray> &noteStates, bool isDisplayedFirstOnStartup);
+    void addVersionToStore();
+    void applyNoteState(int id, QByteArray state);
+    void applyNoteChanges(const QList<NoteChange> &changes, bool redoing);
+    void flushPendingWrite();
+    void clearRedoHistory();
+    HistoryStep diffFromSavedState(const QHash<int, QByteArray> &states);
+    void pushUndoStep(HistoryStep &step);
+    void rebaseHistory(QList<HistoryStep> &history, const QHash<int, QByteArray> &diskStates, const QSet<int> &externalIds);
+    static void trimHistoryToBudget();
+
     void saveStateToHistory();
+    void initSavedStates(QSet<int> editedIds);
+    void releaseSavedStates();
     void saveLastInHistoryToFile();
     void undo();
     void redo();
+    int restoreVersion(int index);
 
     //Properties
     QString filePath();
 
     //Variables
     QList<Note*> notes; //all the notes are stored here
+    QList<Note*> parsedNotes; //parsed, but not yet attached to the notefile
+    int parseError; //the result of the last parseFromFilePath()
+    bool isParsed; //parsedNotes hold the result of a parse that isn't attached yet
+    QMutex parseMutex; //guards the parsing against the background loading
     int lastNoteId;
     std::vector<QString> comment; //the comments in the file
-    QString filePath_m; //note file path
+    QString filePath_m; //note file path, set with setFilePath()
+    QString name_m; //cached, name() is called for every redirecting note
+    QString libraryFolderPath; //the name is the path relative to it (subfolders included), empty for the virtual notefiles
     double eyeX, eyeY, eyeZ; //camera position for the GUI cases (can't be QPointF, it has z)
-    QStringList undoHistory, redoHistory; //The current state is on the back of undoHistory
+    QList<HistoryStep> undoHistory, redoHistory; //deltas between the saved states, the latest ones on the back
+    QHash<int, QByteArray> savedNoteStates; //the last saved state of each note, as compact JSON
+    QHash<int, QByteArray> baseNoteStates; //as last read from or written to the disk, for merging synced changes
+    bool hasSavedState; //the states are made on the first edit, and dropped with the history
+    QSet<int> dirtyNoteIds; //changed since the last save, only these get serialized
+    qint64 historySize; //bytes in undoHistory and redoHistory
+    static QList<NoteFile*> allNoteFiles; //for the history budget
+    static qint64 totalHistorySize;
+    static quint64 lastHistorySequence;
     bool isDisplayedFirstOnStartup;
     bool isTimelineNoteFile;
     bool isReadable;
+    bool isLoaded; //false while only the header (name, size, flags) is known
+    qint64 fileSize;
+    qint64 fileModified; //msecs since epoch, as of the last read or write
+    QByteArray contentHash; //of the contents last read or written
+    LibraryCache *cache; //to restore the parsed notes from, may be nullptr
+    bool parsedNotesHaveLinkGeometry; //restored from the cache, no need to arrange the links
+    bool isSavingSuspended; //while loading tiles or applying undo/redo
+    QTimer persistTimer; //writes the file after undo/redo
+
+    //Paged layout: the notes are in tiles by position, stored in tilesFolderPath(). Only the
+    //tiles around the viewpoint are in notes, the file itself has the index of all the notes
+    bool isPaged;
+    bool needsPaging; //too big to keep in memory, gets converted when attached
+    double tileSize;
+    QHash<int, PagedNoteEntry> noteIndex; //all the notes by id (the resident ones may have moved since)
+    QSet<QString> residentTiles;
+    QTimer tilesTimer; //loads the tiles asked for on paint, outside of it and a few at a time
+    QRectF requestedTilesFrame;
+    QHash<int, Note*> notesByIdWhileLoading; //for the link targets, only set in finishLoadingTiles()
+    QFuture<void> tilesIndexing; //reads the tiles on disk for the library indexes
+    QStringList tileFilesToIndex; //the sequence has to outlive the map
+    QMutex tilesIndexingMutex;
+    QList<Note*> notesReadForIndex; //waiting for handleTileNotesRead()
+    double parsedTileSize; //0 if the parsed file isn't paged
+    QHash<int, PagedNoteEntry> parsedNoteIndex;
     bool saveWithRequest;
-    bool keepHistoryViaGit;
-    bool indexedForSearch;
+    VersionStore *versionStore; //the long term history, may be nullptr
+    SqlStorage *sqlStorage; //if set, the notes are in the library's database instead of the file
 
 signals:
     //Property changes
@@ -90,7 +203,12 @@ signals:
     //Other
     void visualChange();
     void requestingSave(NoteFile*);
+    void loaded(NoteFile*);
     void noteTextChanged(NoteFile*);
+    void notesChanged(NoteFile*, QList<int> ids); //their saved states changed (or they were added/deleted/loaded)
+    void tileNotesRead(NoteFile*, QHash<int, Note*> notes); //of the tiles that aren't loaded, deleted after the signal
+    void mergeConflicts(NoteFile*, int count);
+    void redirectTargetChanged(Note*);
 
 public slots:
     //Set properties
@@ -99,6 +217,7 @@ public slots:
     //Other
     void save();
     void arrangeLinksGeometry();
+    void handleTileNotesRead();
 };
 
 #endif // NOTEFILE_H
@@ -18,6 +18,7 @@
 #include <QComboBox>
 
 #include "notessearch.h"
+#include "memoryusage.h"
 #include "misliwindow.h"
 #include "canvaswidget.h"
 #include "ui_misliwindow.h"
@@ -26,174 +27,313 @@ NotesSearch::NotesSearch(MisliWindow *misli_window, double initial_probability)
 {
     misliWindow = misli_window;
     initialProbability = initial_probability;
-}
 
-//int NotesSearch::loadNotes()
-//{
-//    int notes_loaded=0;
-
-//    for(Library* misliDir: misliWindow->misliLibrary()->misliDirs()  ){
-//        notes_loaded += loadNotes(misliDir,initialProbability);
-//    }
-//    return notes_loaded;
-//}
-//int NotesSearch::loadNotes(Library *lib, double initial_probability)
-//{
-//    int notes_loaded=0;
-
-//    //Load only the notes that are not marked as indexed
-//    for(auto nf: lib->noteFiles()){
-//        if(!nf->indexedForSearch){
-//            notes_loaded += loadNotes(nf, lib, initial_probability);
-//            nf->indexedForSearch = true;
-//        }
-//    }
-//    return notes_loaded;
-//}
-int NotesSearch::loadNotes()
-{
-    int notes_loaded=0;
-    auto lib = misliWindow->misliLibrary();
-
-    //Load only the notes that are not marked as indexed
-    for(auto nf: lib->noteFiles()){
-        if(!nf->indexedForSearch){
-            notes_loaded += loadNotes(nf, lib, initialProbability);
-            nf->indexedForSearch = true;
-        }
-    }
-    return notes_loaded;
+    qRegisterMetaType<NotesSearch::Query>();
+    qRegisterMetaType<QList<NotesSearch::SearchItem>>();
+
+    //The model stays on the GUI thread with its view, only the queries run on the worker thread
+    worker = new SearchWorker;
+    worker->moveToThread(&misliWindow->misliDesktopGUI->workerThread);
+    connect(this, &NotesSearch::queryRequested, worker, &SearchWorker::run);
+    connect(worker, &SearchWorker::resultsFound, this, &NotesSearch::addResults);
+    connect(worker, &SearchWorker::searchFinished, this, &NotesSearch::setResults);
 }
-int NotesSearch::loadNotes(NoteFile *noteFile, Library* lib, double initial_probability)
+NotesSearch::~NotesSearch()
 {
-    int notes_loaded=0;
-    SearchItem searchItem;
+    worker->latestGeneration.fetchAndAddOrdered(1); //cancels the running query
+    worker->deleteLater();
+}
 
-    //Clear all items from this NF if there are any
-    QMutableListIterator<SearchItem> searchItemIterator(searchItems);
-    while(searchItemIterator.hasNext()){
-        searchItem = searchItemIterator.next();
-        if(searchItem.nf==noteFile) searchItemIterator.remove();
+void NotesSearch::handleLibraryLoaded() //its notes are all in the text index now, the results so far may have missed some
+{
+    if(!currentSearchString.isEmpty()) findByText(currentSearchString);
+}
+void NotesSearch::unloadNotes(NoteFile *noteFile) //before the notefile gets deleted
+{
+    beginResetModel();
+    QMutableListIterator<SearchItem> searchResultsIterator(searchResults);
+    while(searchResultsIterator.hasNext()){
+        if(searchResultsIterator.next().nf==noteFile) searchResultsIterator.remove();
     }
+    endResetModel();
 
-    //(Re)load all items
-    for(Note *nt: noteFile->notes){
-        searchItem.nt = nt;
-        searchItem.probability=initial_probability;
-        searchItem.nf = noteFile;
-        searchItem.lib = lib;
-        searchItems.push_back(searchItem);
-        notes_loaded++;
-    }
-    return notes_loaded;
+    //The running query has it in its snapshot, so it's restarted without it
+    if(isSearching) findByText(currentSearchString);
 }
 
 int NotesSearch::rowCount(const QModelIndex &) const
 {
-    if(searchResults.size()<200){
-        return searchResults.size();
-    }else return 200;
-
+    return qMin(searchResults.size(), SEARCH_SHOWN_RESULTS);
 }
 QVariant NotesSearch::data(const QModelIndex & index, int role) const
 {
     if(role==Qt::DisplayRole) return searchResults.at(index.row()).text;
     return QVariant();
 }
-void NotesSearch::findByText(QString searchString)
+void NotesSearch::findByText(QString searchString) //starts the query on the worker thread over what's indexed so far, the results come in addResults() and setResults()
 {
-    loadNotes();
+    int generation = worker->latestGeneration.fetchAndAddOrdered(1) + 1; //the running query stops
+    currentSearchString = searchString;
 
-    int oldSearchResultsSize = searchResults.size();
+    beginResetModel();
     searchResults.clear();
+    endResetModel();
 
     //Skip everything if there's no search string
-    if(!searchString.isEmpty()){
-        searchResults = searchItems;
+    if(searchString.isEmpty()){
+        isSearching = false;
+        emit searchComplete(searchString);
+        return;
     }
 
-    bool addPrecedingDots, addTrailingDots; //when shortening the text - where shortened add dots
+    Query query;
+    query.generation = generation;
+    query.searchString = searchString;
+    query.initialProbability = initialProbability;
 
-    QMutableListIterator<SearchItem> searchResultsIterator(searchResults);
-    while(searchResultsIterator.hasNext()){
-        SearchItem &currentItem = searchResultsIterator.next();
-
-        //Match the scope
-        switch (misliWindow->ui->searchScopeComboBox->currentIndex()) {
-        case 1:
-            if(currentItem.lib!=misliWindow->misliLibrary()){
-                searchResultsIterator.remove();
-                addPrecedingDots = false;
-                addTrailingDots = false;
-                continue;
-            }
-            break;
-        case 2:
-            if(currentItem.nf != misliWindow->currentCanvasWidget()->currentNoteFile) {
-                searchResultsIterator.remove();
-                addPrecedingDots = false;
-                addTrailingDots = false;
-                continue;
-            }
-            break;
-        default:
-            break;
+    //Match the scope. The indexes are implicitly shared, so the snapshots are cheap until the notes change
+    int scope = misliWindow->ui->searchScopeComboBox->currentIndex();
+    if(scope == 2){
+        CanvasWidget *canvas = misliWindow->currentCanvasWidget(); //there's none on the timeline tab
+        NoteFile *currentNoteFile = (canvas != nullptr) ? canvas->currentNoteFile : nullptr;
+        if(currentNoteFile == nullptr){
+            isSearching = false;
+            emit searchComplete(searchString);
+            return;
         }
+        query.noteFileName = currentNoteFile->name();
+    }
+    for(Library *lib: misliWindow->misliDesktopGUI->libraries){
+        if( (scope == 1 || scope == 2) && (lib != misliWindow->misliLibrary()) ) continue;
 
-        //Full match in the beginning (no capitals)
-        if(currentItem.nt->text().startsWith(searchString, Qt::CaseInsensitive)){
-            currentItem.probability = currentItem.probability*1; //100% (just for readability)
-            //Get only the first 100 characters
-            currentItem.text = currentItem.nt->text_m.left(100);
-            if(currentItem.text.size()==100){
-                addTrailingDots = true;
-            }else{
-                addTrailingDots = false;
-            }
-            addPrecedingDots = false;
+        LibrarySnapshot snapshot;
+        snapshot.lib = lib;
+        snapshot.textIndex = lib->textIndex;
+        snapshot.noteFilesByName = lib->noteFilesByName;
+        query.libraries.push_back(snapshot);
+    }
 
-        }else if(currentItem.nt->text().contains(searchString, Qt::CaseInsensitive)){
-            //Full match somewhere else (no capitals)
-            currentItem.probability = currentItem.probability*0.9; //90%
-            //Get the string with 50 preceding characters and 50 after
-            int index = currentItem.nt->text().indexOf(searchString, Qt::CaseInsensitive);
-            if( index<50 ){
-                index = 0;
-                addPrecedingDots = false;
-            }else{
-                index -= 50;
-                addPrecedingDots = true;
-            }
+    isSearching = true;
+    emit queryRequested(query);
+}
+void NotesSearch::addResults(int generation, QList<SearchItem> items)
+{
+    if(generation != worker->latestGeneration.loadAcquire()) return; //a stale query
 
-            currentItem.text = currentItem.nt->text_m.mid(index,index+searchString.size()+100);
+    int first = rowCount(QModelIndex());
+    int last = qMin(searchResults.size() + items.size(), SEARCH_SHOWN_RESULTS) - 1;
 
-            if(currentItem.text.size()>=(index+searchString.size()+100)){
-                addTrailingDots = true;
-            }else{
-                addTrailingDots = false;
-            }
-        }else//Other types of matches
-            //if(){}
-        {
-            searchResultsIterator.remove();
-            addPrecedingDots = false;
+    if(last >= first) beginInsertRows(QModelIndex(), first, last);
+    searchResults.append(items);
+    if(last >= first) endInsertRows();
+}
+void NotesSearch::setResults(int generation, QList<SearchItem> items)
+{
+    if(generation != worker->latestGeneration.loadAcquire()) return;
+
+    //The batches came unsorted, so the list is replaced as a whole
+    beginResetModel();
+    searchResults = items;
+    endResetModel();
+
+    isSearching = false;
+    emit searchComplete(currentSearchString);
+}
+bool NotesSearch::matchNote(SearchItem &currentItem, QString noteText, QString searchString) //sets the probability and the shown text, false if it doesn't match
+{
+    bool addPrecedingDots, addTrailingDots; //when shortening the text - where shortened add dots
+
+    //Full match in the beginning (no capitals)
+    if(noteText.startsWith(searchString, Qt::CaseInsensitive)){
+        currentItem.probability = currentItem.probability*1; //100% (just for readability)
+        //Get only the first 100 characters
+        currentItem.text = noteText.left(100);
+        if(currentItem.text.size()==100){
+            addTrailingDots = true;
+        }else{
             addTrailingDots = false;
         }
+        addPrecedingDots = false;
 
-        if(addPrecedingDots){
-            currentItem.text.prepend("...");
+    }else if(noteText.contains(searchString, Qt::CaseInsensitive)){
+        //Full match somewhere else (no capitals)
+        currentItem.probability = currentItem.probability*0.9; //90%
+        //Get the string with 50 preceding characters and 50 after
+        int index = noteText.indexOf(searchString, Qt::CaseInsensitive);
+        if( index<50 ){
+            index = 0;
+            addPrecedingDots = false;
+        }else{
+            index -= 50;
+            addPrecedingDots = true;
         }
-        if(addTrailingDots){
-            currentItem.text.append("...");
+
+        currentItem.text = noteText.mid(index,index+searchString.size()+100);
+
+        if(currentItem.text.size()>=(index+searchString.size()+100)){
+            addTrailingDots = true;
+        }else{
+            addTrailingDots = false;
         }
+    }else{//Other types of matches
+        return false;
     }
 
-    std::sort(searchResults.begin(),searchResults.end(),compareItems); //order by probability
+    if(addPrecedingDots){
+        currentItem.text.prepend("...");
+    }
+    if(addTrailingDots){
+        currentItem.text.append("...");
+    }
+    return true;
+}
 
-    emit dataChanged(index(0,0),index(oldSearchResultsSize-1,0)); //all of the data has changed
+qint64 NotesSearch::memoryUsage() //estimated bytes of the results, the text indexes are counted by their libraries
+{
+    qint64 bytes = searchResults.size() * qint64(sizeof(SearchItem) + sizeof(void*));
+    for(const SearchItem &item: searchResults) bytes += memorySize(item.text);
+    return bytes;
 }
 
 bool NotesSearch::compareItems(SearchItem first, SearchItem second)
 {
     return first.probability>second.probability;
 }
+
+bool SearchWorker::isCancelled(const NotesSearch::Query &query)
+{
+    return query.generation != latestGeneration.loadAcquire();
+}
+QHash<Library*, quint64> SearchWorker::libraryVersions(const NotesSearch::Query &query)
+{
+    QHash<Library*, quint64> versions;
+    for(const NotesSearch::LibrarySnapshot &snapshot: query.libraries) versions.insert(snapshot.lib, snapshot.textIndex.version);
+    return versions;
+}
+void SearchWorker::dropOutdatedQueries(QHash<Library*, quint64> versions) //the ones from before the notes changed
+{
+    QMutableListIterator<CachedQuery> cachedIterator(cachedQueries);
+    while(cachedIterator.hasNext()){
+        const CachedQuery &cached = cachedIterator.next();
+        for(auto version = versions.constBegin(); version != versions.constEnd(); ++version){
+            if(cached.libraryVersions.contains(version.key()) && (cached.libraryVersions.value(version.key()) != version.value())){
+                cachedIterator.remove();
+                break;
+            }
+        }
+    }
+}
+int SearchWorker::cachedQueryFor(const NotesSearch::Query &query, QHash<Library*, quint64> versions) //the longest cached query that the new one contains, -1 if none
+{
+    int best = -1;
+
+    for(int i=0; i<cachedQueries.size(); i++){
+        const CachedQuery &cached = cachedQueries.at(i);
+        if( (cached.noteFileName != query.noteFileName) || (cached.libraryVersions != versions) ) continue;
+
+        //Every note that contains the new string contains the cached one too
+        if(!query.searchString.contains(cached.searchString, Qt::CaseInsensitive)) continue;
+        if( (best == -1) || (cached.searchString.size() > cachedQueries.at(best).searchString.size()) ) best = i;
+    }
+    return best;
+}
+
+void SearchWorker::run(NotesSearch::Query query)
+{
+    if(isCancelled(query)) return; //typed over while it was queued
+
+    QHash<Library*, quint64> versions = libraryVersions(query);
+    dropOutdatedQueries(versions);
+
+    QList<NotesSearch::SearchItem> results;
+    int cachedIndex = cachedQueryFor(query, versions);
+
+    if(cachedIndex == -1){
+        if(!searchIndexes(query, results)) return;
+    }else{
+        if(!refine(query, cachedQueries.at(cachedIndex), results)) return;
+
+        if(cachedQueries.at(cachedIndex).searchString == query.searchString){
+            cachedQueries.removeAt(cachedIndex); //replaced below, in case a notefile was dropped from it
+        }else{
+            cachedQueries.move(cachedIndex, 0); //used, so it stays for the backspacing
+        }
+    }
+
+    CachedQuery cached;
+    cached.searchString = query.searchString;
+    cached.noteFileName = query.noteFileName;
+    cached.libraryVersions = versions;
+    cached.results = results;
+    cachedQueries.prepend(cached);
+    while(cachedQueries.size() > SEARCH_CACHED_QUERIES) cachedQueries.removeLast();
+
+    emit searchFinished(query.generation, results);
+}
+bool SearchWorker::searchIndexes(const NotesSearch::Query &query, QList<NotesSearch::SearchItem> &results) //false if cancelled
+{
+    QList<NotesSearch::SearchItem> batch;
+    int notesChecked = 0;
+
+    for(const NotesSearch::LibrarySnapshot &snapshot: query.libraries){
+        for(auto nf = snapshot.noteFilesByName.constBegin(); nf != snapshot.noteFilesByName.constEnd(); ++nf){
+            if(isCancelled(query)) return false; //checked per notefile, so a keystroke doesn't wait for the whole library
+            if( !query.noteFileName.isEmpty() && (nf.key() != query.noteFileName) ) continue;
+
+            //Only the notes that have all the trigrams of the search string get compared
+            QList<int> ids = snapshot.textIndex.candidates(nf.key(), query.searchString).toList();
+            std::sort(ids.begin(), ids.end());
+
+            for(int id: ids){
+                if( (++notesChecked % 1000 == 0) && isCancelled(query) ) return false; //for the big notefiles
+                NotesSearch::SearchItem item;
+                item.lib = snapshot.lib;
+                item.nf = nf.value();
+                item.noteFileName = nf.key();
+                item.noteId = id;
+                item.probability = query.initialProbability;
+                if(NotesSearch::matchNote(item, snapshot.textIndex.text(nf.key(), id), query.searchString)){
+                    batch.push_back(item);
+                }
+            }
+            if(batch.size() >= SEARCH_RESULTS_BATCH){
+                emit resultsFound(query.generation, batch);
+                results.append(batch);
+                batch.clear();
+            }
+        }
+    }
+    if(isCancelled(query)) return false;
+
+    results.append(batch);
+    std::stable_sort(results.begin(),results.end(),NotesSearch::compareItems); //order by probability
+    return true;
+}
+bool SearchWorker::refine(const NotesSearch::Query &query, const CachedQuery &cached, QList<NotesSearch::SearchItem> &results) //false if cancelled
+{
+    QHash<Library*, const NotesSearch::LibrarySnapshot*> snapshots;
+    for(const NotesSearch::LibrarySnapshot &snapshot: query.libraries) snapshots.insert(snapshot.lib, &snapshot);
+    bool isSameQuery = (cached.searchString == query.searchString);
+    int notesChecked = 0;
+
+    for(NotesSearch::SearchItem item: cached.results){
+        if( (++notesChecked % 1000 == 0) && isCancelled(query) ) return false;
+
+        //A notefile that is being unloaded may still be in the cached results
+        const NotesSearch::LibrarySnapshot *snapshot = snapshots.value(item.lib, nullptr);
+        if( (snapshot == nullptr) || (snapshot->noteFilesByName.value(item.noteFileName) != item.nf) ) continue;
+
+        if(isSameQuery){
+            results.push_back(item);
+            continue;
+        }
+        item.probability = query.initialProbability;
+        if(NotesSearch::matchNote(item, snapshot->textIndex.text(item.noteFileName, item.noteId), query.searchString)){
+            results.push_back(item);
+        }
+    }
+    if(isCancelled(query)) return false;
+
+    if(!isSameQuery) std::stable_sort(results.begin(),results.end(),NotesSearch::compareItems); //a match at the start may have moved
+    return true;
+}
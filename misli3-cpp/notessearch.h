@@ -18,10 +18,12 @@
 #define NOTESSEARCH_H
 
 #include <QAbstractListModel>
+#include <QAtomicInt>
 
 #include "library.h"
 
 class MisliWindow;
+class SearchWorker;
 
 class NotesSearch : public QAbstractListModel
 {
@@ -30,30 +32,88 @@ public:
     struct SearchItem{
         Library *lib;
         NoteFile *nf;
-        Note *nt;
+        QString noteFileName; //to check the cached results against a new snapshot
+        int noteId;
         double probability;
         QString text;
     };
+    struct LibrarySnapshot{ //copied on the GUI thread, read on the worker thread
+        Library *lib;
+        TrigramIndex textIndex;
+        QHash<QString, NoteFile*> noteFilesByName;
+    };
+    struct Query{
+        int generation;
+        QString searchString;
+        QString noteFileName; //if set, only that notefile is searched
+        double initialProbability;
+        QList<LibrarySnapshot> libraries;
+    };
 
     //Functions
     NotesSearch(MisliWindow *misli_window, double initial_probability);
-    int loadNotes();
-    int loadNotes(Library * lib, double initial_probability);
-    int loadNotes(NoteFile * noteFile, Library *lib, double initial_probability);
+    ~NotesSearch();
+    void handleLibraryLoaded();
+    void unloadNotes(NoteFile * noteFile);
+    static bool matchNote(SearchItem &item, QString noteText, QString searchString);
     static bool compareItems(SearchItem first, SearchItem second);
+    qint64 memoryUsage();
 
     //Variables
-    QList<SearchItem> searchItems,searchResults;
+    QList<SearchItem> searchResults;
     double initialProbability;
     MisliWindow *misliWindow;
+    SearchWorker *worker; //on the workerThread of MisliDesktopGui
+    QString currentSearchString;
+    bool isSearching = false;
 
 signals:
     void searchComplete(QString string);
+    void queryRequested(NotesSearch::Query query);
     
 public slots:
     int rowCount(const QModelIndex &) const;
     QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const;
     void findByText(QString searchString);
+    void addResults(int generation, QList<NotesSearch::SearchItem> items);
+    void setResults(int generation, QList<NotesSearch::SearchItem> items);
+};
+
+//Runs the queries of NotesSearch on the snapshots they carry. Each new query
+//bumps latestGeneration, so the older ones stop at their next check. The
+//results of the last few queries are kept, so a query that extends one of
+//them (typing on) only filters its results, and a repeated one (backspacing)
+//reuses them, as long as the indexes haven't changed since.
+class SearchWorker : public QObject
+{
+    Q_OBJECT
+public:
+    QAtomicInt latestGeneration;
+
+signals:
+    void resultsFound(int generation, QList<NotesSearch::SearchItem> items); //a batch, in no particular order
+    void searchFinished(int generation, QList<NotesSearch::SearchItem> items); //all of them, sorted
+
+public slots:
+    void run(NotesSearch::Query query);
+
+private:
+    struct CachedQuery{
+        QString searchString, noteFileName;
+        QHash<Library*, quint64> libraryVersions; //of their text indexes
+        QList<NotesSearch::SearchItem> results; //sorted
+    };
+    bool isCancelled(const NotesSearch::Query &query);
+    bool searchIndexes(const NotesSearch::Query &query, QList<NotesSearch::SearchItem> &results);
+    bool refine(const NotesSearch::Query &query, const CachedQuery &cached, QList<NotesSearch::SearchItem> &results);
+    void dropOutdatedQueries(QHash<Library*, quint64> versions);
+    int cachedQueryFor(const NotesSearch::Query &query, QHash<Library*, quint64> versions);
+    static QHash<Library*, quint64> libraryVersions(const NotesSearch::Query &query);
+
+    QList<CachedQuery> cachedQueries; //the last used first, only touched on the worker thread
 };
 
+Q_DECLARE_METATYPE(NotesSearch::SearchItem)
+Q_DECLARE_METATYPE(NotesSearch::Query)
+
 #endif // NOTESSEARCH_H
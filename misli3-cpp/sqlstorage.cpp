@@ -0,0 +1,336 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QThread>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+#include "sqlstorage.h"
+#include "notefile.h"
+#include "folderscanner.h"
+#include "global.h"
+
+SqlStorage::SqlStorage(QString databasePath_)
+{
+    databasePath = databasePath_;
+}
+SqlStorage::~SqlStorage()
+{
+    for(QString connectionName: QSqlDatabase::connectionNames()){
+        if(connectionName.startsWith(databasePath)) QSqlDatabase::removeDatabase(connectionName);
+    }
+}
+
+QSqlDatabase SqlStorage::database() //a connection can be used only by the thread that opened it
+{
+    QString connectionName = databasePath + "#" + QString::number(quintptr(QThread::currentThread()));
+    if(QSqlDatabase::contains(connectionName)) return QSqlDatabase::database(connectionName);
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    db.setDatabaseName(databasePath);
+    if(!db.open()){
+        qDebug()<<"[SqlStorage::database]Failed opening the database:"<<db.lastError().text();
+        return db;
+    }
+    db.exec("PRAGMA busy_timeout = 5000");
+    return db;
+}
+
+bool SqlStorage::open()
+{
+    QSqlDatabase db = database();
+    if(!db.isOpen()) return false;
+
+    //The writes don't block the readers, and a commit doesn't wait for the disk every time
+    db.exec("PRAGMA journal_mode = WAL");
+    db.exec("PRAGMA synchronous = NORMAL");
+
+    QStringList statements;
+    statements << "CREATE TABLE IF NOT EXISTS notefiles(name TEXT PRIMARY KEY, is_displayed_first_on_startup INTEGER NOT NULL DEFAULT 0)"
+               << "CREATE TABLE IF NOT EXISTS notes(notefile TEXT NOT NULL, id INTEGER NOT NULL, text TEXT,"
+                  " x REAL, y REAL, width REAL, height REAL, t_made TEXT, t_mod TEXT, state BLOB NOT NULL,"
+                  " PRIMARY KEY(notefile, id))"
+               << "CREATE TABLE IF NOT EXISTS links(notefile TEXT NOT NULL, from_id INTEGER NOT NULL, to_id INTEGER NOT NULL,"
+                  " text TEXT, PRIMARY KEY(notefile, from_id, to_id))"
+               << "CREATE TABLE IF NOT EXISTS tags(notefile TEXT NOT NULL, note_id INTEGER NOT NULL, tag TEXT NOT NULL,"
+                  " PRIMARY KEY(notefile, note_id, tag))"
+               << "CREATE INDEX IF NOT EXISTS tags_by_tag ON tags(tag)"
+               << "CREATE TABLE IF NOT EXISTS meta(key TEXT PRIMARY KEY, value TEXT NOT NULL)";
+
+    for(QString statement: statements){
+        QSqlQuery query = db.exec(statement);
+        if(query.lastError().isValid()){
+            qDebug()<<"[SqlStorage::open]Failed making the tables:"<<query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+QStringList SqlStorage::noteFileNames()
+{
+    QStringList names;
+    QSqlQuery query = database().exec("SELECT name FROM notefiles ORDER BY name");
+    while(query.next()) names.push_back(query.value(0).toString());
+    return names;
+}
+bool SqlStorage::addNoteFile(QString name)
+{
+    QSqlQuery query(database());
+    query.prepare("INSERT OR IGNORE INTO notefiles(name) VALUES(?)");
+    query.addBindValue(name);
+    return query.exec();
+}
+bool SqlStorage::removeNoteFile(QString name)
+{
+    QSqlDatabase db = database();
+    db.transaction();
+    QStringList statements;
+    statements << "DELETE FROM notes WHERE notefile = ?"
+               << "DELETE FROM links WHERE notefile = ?"
+               << "DELETE FROM tags WHERE notefile = ?"
+               << "DELETE FROM notefiles WHERE name = ?";
+    for(QString statement: statements){
+        QSqlQuery query(db);
+        query.prepare(statement);
+        query.addBindValue(name);
+        if(!query.exec()){
+            qDebug()<<"[SqlStorage::removeNoteFile]"<<query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    return db.commit();
+}
+bool SqlStorage::renameNoteFile(QString oldName, QString newName)
+{
+    QSqlDatabase db = database();
+    db.transaction();
+    QStringList statements;
+    statements << "UPDATE notes SET notefile = ? WHERE notefile = ?"
+               << "UPDATE links SET notefile = ? WHERE notefile = ?"
+               << "UPDATE tags SET notefile = ? WHERE notefile = ?"
+               << "UPDATE notefiles SET name = ? WHERE name = ?";
+    for(QString statement: statements){
+        QSqlQuery query(db);
+        query.prepare(statement);
+        query.addBindValue(newName);
+        query.addBindValue(oldName);
+        if(!query.exec()){
+            qDebug()<<"[SqlStorage::renameNoteFile]"<<query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    return db.commit();
+}
+bool SqlStorage::isDisplayedFirstOnStartup(QString name)
+{
+    QSqlQuery query(database());
+    query.prepare("SELECT is_displayed_first_on_startup FROM notefiles WHERE name = ?");
+    query.addBindValue(name);
+    query.exec();
+    return query.next() && query.value(0).toBool();
+}
+QString SqlStorage::metaValue(QString key) //empty if it's not set
+{
+    QSqlQuery query(database());
+    query.prepare("SELECT value FROM meta WHERE key = ?");
+    query.addBindValue(key);
+    query.exec();
+    return query.next() ? query.value(0).toString() : QString();
+}
+bool SqlStorage::setMetaValue(QString key, QString value)
+{
+    QSqlQuery query(database());
+    query.prepare("INSERT OR REPLACE INTO meta(key, value) VALUES(?, ?)");
+    query.addBindValue(key);
+    query.addBindValue(value);
+    if(!query.exec()){
+        qDebug()<<"[SqlStorage::setMetaValue]"<<query.lastError().text();
+        return false;
+    }
+    return true;
+}
+QList<QByteArray> SqlStorage::readNoteStates(QString name) //an indexed query, by id
+{
+    QList<QByteArray> states;
+    QSqlQuery query(database());
+    query.setForwardOnly(true);
+    query.prepare("SELECT state FROM notes WHERE notefile = ? ORDER BY id");
+    query.addBindValue(name);
+    query.exec();
+    while(query.next()) states.push_back(query.value(0).toByteArray());
+    return states;
+}
+
+bool SqlStorage::upsertNote(QSqlDatabase &db, QString name, int id, const QByteArray &state)
+{
+    QJsonObject json = QJsonDocument::fromJson(state).object();
+
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO notes(notefile, id, text, x, y, width, height, t_made, t_mod, state)"
+                  " VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    query.addBindValue(name);
+    query.addBindValue(id);
+    query.addBindValue(json["text"].toString());
+    query.addBindValue(json["x"].toDouble());
+    query.addBindValue(json["y"].toDouble());
+    query.addBindValue(json["width"].toDouble());
+    query.addBindValue(json["height"].toDouble());
+    query.addBindValue(json["t_made"].toString());
+    query.addBindValue(json["t_mod"].toString());
+    query.addBindValue(state);
+    if(!query.exec()) return false;
+
+    //The links and tags of the note are replaced with it
+    QSqlQuery deleteLinks(db), deleteTags(db);
+    deleteLinks.prepare("DELETE FROM links WHERE notefile = ? AND from_id = ?");
+    deleteLinks.addBindValue(name);
+    deleteLinks.addBindValue(id);
+    deleteLinks.exec();
+    deleteTags.prepare("DELETE FROM tags WHERE notefile = ? AND note_id = ?");
+    deleteTags.addBindValue(name);
+    deleteTags.addBindValue(id);
+    deleteTags.exec();
+
+    for(QJsonValue ln: json["links"].toArray()){
+        QSqlQuery linkQuery(db);
+        linkQuery.prepare("INSERT OR REPLACE INTO links(notefile, from_id, to_id, text) VALUES(?, ?, ?, ?)");
+        linkQuery.addBindValue(name);
+        linkQuery.addBindValue(id);
+        linkQuery.addBindValue(ln.toObject()["to_id"].toInt());
+        linkQuery.addBindValue(ln.toObject()["text"].toString());
+        linkQuery.exec();
+    }
+    for(QJsonValue tag: json["tags"].toArray()){
+        QSqlQuery tagQuery(db);
+        tagQuery.prepare("INSERT OR IGNORE INTO tags(notefile, note_id, tag) VALUES(?, ?, ?)");
+        tagQuery.addBindValue(name);
+        tagQuery.addBindValue(id);
+        tagQuery.addBindValue(tag.toString());
+        tagQuery.exec();
+    }
+    return true;
+}
+bool SqlStorage::deleteNote(QSqlDatabase &db, QString name, int id)
+{
+    QStringList statements;
+    statements << "DELETE FROM notes WHERE notefile = ? AND id = ?"
+               << "DELETE FROM links WHERE notefile = ? AND from_id = ?"
+               << "DELETE FROM tags WHERE notefile = ? AND note_id = ?";
+    for(QString statement: statements){
+        QSqlQuery query(db);
+        query.prepare(statement);
+        query.addBindValue(name);
+        query.addBindValue(id);
+        if(!query.exec()) return false;
+    }
+    return true;
+}
+bool SqlStorage::writeNoteStates(QString name, const QHash<int, QByteArray> &oldStates,
+                                 const QHash<int, QByteArray> &newStates, bool isDisplayedFirstOnStartup)
+{
+    QSqlDatabase db = database();
+    bool ok = db.transaction();
+
+    QSqlQuery notefileQuery(db);
+    notefileQuery.prepare("INSERT OR REPLACE INTO notefiles(name, is_displayed_first_on_startup) VALUES(?, ?)");
+    notefileQuery.addBindValue(name);
+    notefileQuery.addBindValue(isDisplayedFirstOnStartup ? 1 : 0);
+    ok &= notefileQuery.exec();
+
+    //Only the rows of the notes that differ get written
+    for(auto state = newStates.constBegin(); state != newStates.constEnd(); ++state){
+        if(oldStates.value(state.key()) != state.value()) ok &= upsertNote(db, name, state.key(), state.value());
+    }
+    for(auto state = oldStates.constBegin(); state != oldStates.constEnd(); ++state){
+        if(!newStates.contains(state.key())) ok &= deleteNote(db, name, state.key());
+    }
+
+    if(!ok){
+        qDebug()<<"[SqlStorage::writeNoteStates]Failed writing"<<name<<":"<<db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return db.commit();
+}
+int SqlStorage::importJsonFolder(QString folderPath) //returns the number of imported notefiles, it's done once per database
+{
+    QDir dir(folderPath);
+    int imported = 0;
+
+    for(QString fileName: FolderScanner(folderPath, QStringList()<<"*.json", LIBRARY_SKIPPED_FOLDERS).scan()){
+        QFile file(dir.filePath(fileName));
+        if(!file.open(QIODevice::ReadOnly)) continue;
+        QJsonObject json = QJsonDocument::fromJson(file.readAll()).object();
+        file.close();
+
+        QString name = fileName.left(fileName.size() - 5); //with the subfolders
+        QHash<int, QByteArray> states;
+
+        if(json["paged"].toBool()){ //the notes are in the tiles, each one in the tile the index says
+            QHash<QString, QHash<int, QJsonObject>> tiles; //the notes of each read tile, by id
+            for(QJsonValue entryValue: json["note_index"].toArray()){
+                QJsonObject entry = entryValue.toObject();
+                QString tile = entry["tile"].toString();
+                bool isRead = tiles.contains(tile);
+                QHash<int, QJsonObject> &tileNotes = tiles[tile];
+                if(!isRead){
+                    QFile tileFile(dir.filePath(name + ".tiles/" + tile + ".json"));
+                    if(tileFile.open(QIODevice::ReadOnly)){
+                        for(QJsonValue nt: QJsonDocument::fromJson(tileFile.readAll()).object()["notes"].toArray()){
+                            tileNotes.insert(nt.toObject()["id"].toInt(), nt.toObject());
+                        }
+                    }
+                }
+                int id = entry["id"].toInt();
+                if(tileNotes.contains(id)) states.insert(id, QJsonDocument(tileNotes.value(id)).toJson(QJsonDocument::Compact));
+            }
+        }else{
+            for(QJsonValue nt: json["notes"].toArray()){
+                states.insert(nt.toObject()["id"].toInt(), QJsonDocument(nt.toObject()).toJson(QJsonDocument::Compact));
+            }
+        }
+
+        if(writeNoteStates(name, QHash<int, QByteArray>(), states, json["is_displayed_first_on_startup"].toBool())) imported++;
+    }
+    qDebug()<<"[SqlStorage::importJsonFolder]Imported"<<imported<<"note files from"<<folderPath;
+    setMetaValue("json_imported", "1"); //so the notefiles deleted later don't come back with another import
+    return imported;
+}
+int SqlStorage::exportToJsonFolder(QString folderPath) //returns the number of exported notefiles
+{
+    QDir dir(folderPath);
+    int exported = 0;
+
+    for(QString name: noteFileNames()){
+        QDir().mkpath(QFileInfo(dir.filePath(name + ".json")).absolutePath());
+        QSaveFile file(dir.filePath(name + ".json"));
+        if(!file.open(QIODevice::WriteOnly)) continue;
+        file.write(NoteFile::jsonFileContents(readNoteStates(name), isDisplayedFirstOnStartup(name)));
+        if(file.commit()) exported++;
+    }
+    return exported;
+}
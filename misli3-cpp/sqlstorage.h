@@ -0,0 +1,61 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SQLSTORAGE_H
+#define SQLSTORAGE_H
+
+#include <QHash>
+#include <QPair>
+#include <QStringList>
+#include <QtSql/QSqlDatabase>
+
+//Optional storage backend: all the notefiles of a library in one SQLite
+//database (WAL mode) instead of .json files. A note is a row with its state
+//(the same compact JSON the undo history uses) and its links and tags in
+//their own tables, so a save writes only the rows of the changed notes.
+//Each thread gets its own connection, the background loading reads in parallel.
+class SqlStorage
+{
+public:
+    //Functions
+    SqlStorage(QString databasePath);
+    ~SqlStorage();
+
+    bool open();
+    QStringList noteFileNames();
+    bool addNoteFile(QString name);
+    bool removeNoteFile(QString name);
+    bool renameNoteFile(QString oldName, QString newName);
+    bool isDisplayedFirstOnStartup(QString name);
+    QString metaValue(QString key);
+    bool setMetaValue(QString key, QString value);
+    QList<QByteArray> readNoteStates(QString name);
+    bool writeNoteStates(QString name, const QHash<int, QByteArray> &oldStates,
+                         const QHash<int, QByteArray> &newStates, bool isDisplayedFirstOnStartup);
+
+    int importJsonFolder(QString folderPath);
+    int exportToJsonFolder(QString folderPath);
+
+    //Variables
+    QString databasePath;
+
+private:
+    QSqlDatabase database();
+    bool upsertNote(QSqlDatabase &db, QString name, int id, const QByteArray &state);
+    bool deleteNote(QSqlDatabase &db, QString name, int id);
+};
+
+#endif // SQLSTORAGE_H
@@ -0,0 +1,103 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+
+#include "tagindex.h"
+#include "notefile.h"
+#include "memoryusage.h"
+
+bool TagIndex::setTags(Posting note, QStringList tags)
+{
+    tags.removeDuplicates();
+    QStringList oldTags = tagsOfNote.value(note);
+    if(oldTags == tags) return false;
+
+    for(QString tag: oldTags){
+        auto tagPostings = postings.find(tag);
+        if(tagPostings == postings.end()) continue;
+        tagPostings->remove(note);
+        if(tagPostings->isEmpty()) postings.erase(tagPostings);
+    }
+    for(QString tag: tags) postings[tag].insert(note);
+
+    if(tags.isEmpty()){
+        tagsOfNote.remove(note);
+        taggedIdsByNoteFile[note.first].remove(note.second);
+        if(taggedIdsByNoteFile[note.first].isEmpty()) taggedIdsByNoteFile.remove(note.first);
+    }else{
+        tagsOfNote.insert(note, tags);
+        taggedIdsByNoteFile[note.first].insert(note.second);
+    }
+    return true;
+}
+
+bool TagIndex::updateNotes(QString name, QHash<int, Note*> notes)
+{
+    bool changed = false;
+
+    for(auto note = notes.constBegin(); note != notes.constEnd(); ++note){
+        Note *nt = note.value();
+        if(setTags(Posting(name, note.key()), (nt == nullptr) ? QStringList() : nt->tags)) changed = true;
+    }
+    return changed;
+}
+bool TagIndex::removeNoteFile(QString name)
+{
+    QSet<int> ids = taggedIdsByNoteFile.value(name);
+    for(int id: ids) setTags(Posting(name, id), QStringList());
+    return !ids.isEmpty();
+}
+void TagIndex::renameNoteFile(QString oldName, QString newName)
+{
+    QSet<int> ids = taggedIdsByNoteFile.value(oldName);
+    for(int id: ids){
+        QStringList tags = tagsOfNote.value(Posting(oldName, id));
+        setTags(Posting(oldName, id), QStringList());
+        setTags(Posting(newName, id), tags);
+    }
+}
+
+QSet<TagIndex::Posting> TagIndex::notesTagged(QString tag) const
+{
+    return postings.value(tag);
+}
+int TagIndex::count(QString tag) const
+{
+    return postings.value(tag).size();
+}
+QList<QPair<QString, int>> TagIndex::tagsByFrequency() const //the most used first, then alphabetically
+{
+    QList<QPair<QString, int>> tags;
+    for(auto tag = postings.constBegin(); tag != postings.constEnd(); ++tag){
+        tags.push_back(qMakePair(tag.key(), tag.value().size()));
+    }
+    std::sort(tags.begin(), tags.end(), [](const QPair<QString, int> &a, const QPair<QString, int> &b){
+        if(a.second != b.second) return a.second > b.second;
+        return a.first < b.first;
+    });
+    return tags;
+}
+qint64 TagIndex::memoryUsage() const //estimated bytes, the names are shared with the notefiles
+{
+    qint64 bytes = memorySize(postings) + memorySize(tagsOfNote) + memorySize(taggedIdsByNoteFile);
+    for(auto tag = postings.constBegin(); tag != postings.constEnd(); ++tag){
+        bytes += memorySize(tag.key()) + tag.value().size() * qint64(sizeof(Posting) + 2 * sizeof(void*));
+    }
+    for(const QStringList &tags: tagsOfNote) bytes += tags.size() * qint64(sizeof(void*)); //the strings are shared with the notes
+    for(const QSet<int> &ids: taggedIdsByNoteFile) bytes += ids.size() * qint64(sizeof(int) + 2 * sizeof(void*));
+    return bytes;
+}
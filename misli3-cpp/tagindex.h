@@ -0,0 +1,54 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TAGINDEX_H
+#define TAGINDEX_H
+
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+
+class Note;
+
+//An inverted index of the tags of the loaded notes: tag -> (notefile name,
+//note id). It's updated per changed note like the LibraryGraph, so the
+//lookups and the counts don't touch the notes.
+class TagIndex
+{
+public:
+    typedef QPair<QString, int> Posting;
+
+    //Functions
+    bool updateNotes(QString noteFileName, QHash<int, Note*> notes); //nullptr for the deleted ones. True if a tag was added, removed or recounted
+    bool removeNoteFile(QString name);
+    void renameNoteFile(QString oldName, QString newName);
+
+    QSet<Posting> notesTagged(QString tag) const;
+    int count(QString tag) const;
+    QList<QPair<QString, int>> tagsByFrequency() const;
+    qint64 memoryUsage() const;
+
+    //Variables
+    QHash<QString, QSet<Posting>> postings;
+    QHash<Posting, QStringList> tagsOfNote; //to remove the old postings when a note changes
+    QHash<QString, QSet<int>> taggedIdsByNoteFile;
+
+private:
+    bool setTags(Posting note, QStringList tags);
+};
+
+#endif // TAGINDEX_H
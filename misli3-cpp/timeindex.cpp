@@ -0,0 +1,97 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "timeindex.h"
+#include "notefile.h"
+#include "memoryusage.h"
+
+void TimeIndex::setTimes(Posting note, qint64 made, qint64 modified)
+{
+    auto entry = entries.find(note);
+    if(entry != entries.end()){
+        if( (entry->made->first == made) && (entry->modified->first == modified) ) return;
+        timesMade.erase(entry->made);
+        timesModified.erase(entry->modified);
+    }else{
+        entry = entries.insert(note, Entry());
+        idsByNoteFile[note.first].insert(note.second);
+    }
+    entry->made = timesMade.insert(std::make_pair(made, note));
+    entry->modified = timesModified.insert(std::make_pair(modified, note));
+}
+void TimeIndex::removeNote(Posting note)
+{
+    auto entry = entries.find(note);
+    if(entry == entries.end()) return;
+
+    timesMade.erase(entry->made);
+    timesModified.erase(entry->modified);
+    entries.erase(entry);
+
+    idsByNoteFile[note.first].remove(note.second);
+    if(idsByNoteFile[note.first].isEmpty()) idsByNoteFile.remove(note.first);
+}
+
+void TimeIndex::updateNotes(QString name, QHash<int, Note*> notes)
+{
+    for(auto changed = notes.constBegin(); changed != notes.constEnd(); ++changed){
+        Posting note(name, changed.key());
+        Note *nt = changed.value();
+        if(nt == nullptr){
+            removeNote(note);
+        }else{
+            setTimes(note, nt->timeMade.toMSecsSinceEpoch(), nt->timeModified.toMSecsSinceEpoch());
+        }
+    }
+}
+void TimeIndex::removeNoteFile(QString name)
+{
+    for(int id: idsByNoteFile.value(name)) removeNote(Posting(name, id));
+}
+void TimeIndex::renameNoteFile(QString oldName, QString newName)
+{
+    for(int id: idsByNoteFile.value(oldName)){
+        Entry entry = entries.value(Posting(oldName, id));
+        qint64 made = entry.made->first, modified = entry.modified->first;
+        removeNote(Posting(oldName, id));
+        setTimes(Posting(newName, id), made, modified);
+    }
+}
+
+QList<TimeIndex::Posting> TimeIndex::between(const Times &times, qint64 from, qint64 to)
+{
+    QList<Posting> notes;
+    for(auto it = times.lower_bound(from); (it != times.end()) && (it->first < to); ++it){
+        notes.push_back(it->second);
+    }
+    return notes;
+}
+QList<TimeIndex::Posting> TimeIndex::madeBetween(qint64 from, qint64 to) const
+{
+    return between(timesMade, from, to);
+}
+QList<TimeIndex::Posting> TimeIndex::modifiedBetween(qint64 from, qint64 to) const
+{
+    return between(timesModified, from, to);
+}
+qint64 TimeIndex::memoryUsage() const //estimated bytes, the map nodes have 3 pointers and a color
+{
+    qint64 mapNodeSize = sizeof(Times::value_type) + 4 * sizeof(void*);
+    qint64 bytes = qint64(timesMade.size() + timesModified.size()) * mapNodeSize;
+    bytes += memorySize(entries) + memorySize(idsByNoteFile);
+    for(const QSet<int> &ids: idsByNoteFile) bytes += ids.size() * qint64(sizeof(int) + 2 * sizeof(void*));
+    return bytes;
+}
@@ -0,0 +1,63 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TIMEINDEX_H
+#define TIMEINDEX_H
+
+#include <map>
+
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QStringList>
+
+class Note;
+
+//The loaded notes sorted by their creation and modification times (in msecs
+//since the epoch), for the timeline and the date filters. A range query is a
+//binary search plus the results. It's updated per changed note like the
+//LibraryGraph.
+class TimeIndex
+{
+public:
+    typedef QPair<QString, int> Posting;
+    typedef std::multimap<qint64, Posting> Times;
+
+    //Functions
+    void updateNotes(QString noteFileName, QHash<int, Note*> notes); //nullptr for the deleted ones
+    void removeNoteFile(QString name);
+    void renameNoteFile(QString oldName, QString newName);
+
+    QList<Posting> madeBetween(qint64 from, qint64 to) const; //from <= t < to
+    QList<Posting> modifiedBetween(qint64 from, qint64 to) const;
+    qint64 memoryUsage() const;
+
+    //Variables
+    Times timesMade, timesModified;
+
+private:
+    struct Entry{
+        Times::iterator made, modified; //stay valid until erased
+    };
+    void setTimes(Posting note, qint64 made, qint64 modified);
+    void removeNote(Posting note);
+    static QList<Posting> between(const Times &times, qint64 from, qint64 to);
+
+    QHash<Posting, Entry> entries;
+    QHash<QString, QSet<int>> idsByNoteFile;
+};
+
+#endif // TIMEINDEX_H
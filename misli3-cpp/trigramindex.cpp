@@ -0,0 +1,159 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <iterator>
+
+#include "trigramindex.h"
+#include "notefile.h"
+#include "memoryusage.h"
+
+QVector<TrigramIndex::Trigram> TrigramIndex::trigrams(QString text)
+{
+    //Simple case folding maps one code unit to one, so the positions match QString::contains(..., Qt::CaseInsensitive)
+    QString folded = text.toCaseFolded();
+    QVector<Trigram> result;
+    if(folded.size() < 3) return result;
+
+    const ushort *units = folded.utf16();
+    result.reserve(folded.size() - 2);
+    for(int i = 0; i + 2 < folded.size(); i++){
+        result.push_back( (Trigram(units[i]) << 32) | (Trigram(units[i+1]) << 16) | Trigram(units[i+2]) );
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+void TrigramIndex::setText(NoteFileIndex &index, int id, QString text)
+{
+    bool isIndexed = index.trigramsOfNote.contains(id);
+    if(isIndexed && (index.texts.value(id) == text)) return; //e.g. the note was only moved
+
+    index.texts.insert(id, text);
+    version++;
+
+    QVector<Trigram> newTrigrams = trigrams(text);
+    QVector<Trigram> oldTrigrams = index.trigramsOfNote.value(id);
+    if(isIndexed && (newTrigrams == oldTrigrams)) return;
+
+    //Touch only the postings of the trigrams that came or went
+    QVector<Trigram> removed, added;
+    std::set_difference(oldTrigrams.begin(), oldTrigrams.end(), newTrigrams.begin(), newTrigrams.end(), std::back_inserter(removed));
+    std::set_difference(newTrigrams.begin(), newTrigrams.end(), oldTrigrams.begin(), oldTrigrams.end(), std::back_inserter(added));
+
+    for(Trigram trigram: removed){
+        auto posting = index.postings.find(trigram);
+        if(posting == index.postings.end()) continue;
+        posting->remove(id);
+        if(posting->isEmpty()) index.postings.erase(posting);
+    }
+    for(Trigram trigram: added) index.postings[trigram].insert(id);
+
+    index.trigramsOfNote.insert(id, newTrigrams); //also the short ones, so they get checked for short queries
+}
+void TrigramIndex::removeNote(NoteFileIndex &index, int id)
+{
+    if(!index.trigramsOfNote.contains(id)) return;
+
+    index.texts.remove(id);
+    version++;
+    for(Trigram trigram: index.trigramsOfNote.take(id)){
+        auto posting = index.postings.find(trigram);
+        if(posting == index.postings.end()) continue;
+        posting->remove(id);
+        if(posting->isEmpty()) index.postings.erase(posting);
+    }
+}
+
+void TrigramIndex::updateNotes(QString name, QHash<int, Note*> notes)
+{
+    NoteFileIndex &index = noteFiles[name];
+
+    for(auto note = notes.constBegin(); note != notes.constEnd(); ++note){
+        if(note.value() == nullptr){
+            removeNote(index, note.key());
+        }else{
+            setText(index, note.key(), note.value()->text());
+        }
+    }
+    if(index.trigramsOfNote.isEmpty()) noteFiles.remove(name);
+}
+void TrigramIndex::removeNoteFile(QString name)
+{
+    if(noteFiles.remove(name) > 0) version++;
+}
+void TrigramIndex::renameNoteFile(QString oldName, QString newName)
+{
+    if(!noteFiles.contains(oldName)) return;
+
+    noteFiles.insert(newName, noteFiles.take(oldName));
+    version++;
+}
+
+QSet<int> TrigramIndex::candidates(QString noteFileName, QString query) const
+{
+    auto index = noteFiles.constFind(noteFileName);
+    if(index == noteFiles.constEnd()) return QSet<int>();
+
+    QVector<Trigram> queryTrigrams = trigrams(query);
+    if(queryTrigrams.isEmpty()) return index->trigramsOfNote.keys().toSet(); //nothing to narrow it down with
+
+    QVector<const QSet<int>*> postings;
+    for(Trigram trigram: queryTrigrams){
+        auto posting = index->postings.constFind(trigram);
+        if(posting == index->postings.constEnd()) return QSet<int>(); //no note has it
+        postings.push_back(&posting.value());
+    }
+
+    //Intersect starting from the shortest list, so the rest are only looked up
+    std::sort(postings.begin(), postings.end(), [](const QSet<int> *a, const QSet<int> *b){
+        return a->size() < b->size();
+    });
+    QSet<int> ids;
+    for(int id: *postings.first()){
+        bool isInAll = true;
+        for(int i = 1; (i < postings.size()) && isInAll; i++) isInAll = postings[i]->contains(id);
+        if(isInAll) ids.insert(id);
+    }
+    return ids;
+}
+QString TrigramIndex::text(QString noteFileName, int id) const
+{
+    auto index = noteFiles.constFind(noteFileName);
+    if(index == noteFiles.constEnd()) return QString();
+    return index->texts.value(id);
+}
+QStringList TrigramIndex::noteFileNames() const
+{
+    return noteFiles.keys();
+}
+int TrigramIndex::noteCount() const
+{
+    int count = 0;
+    for(const NoteFileIndex &index: noteFiles) count += index.trigramsOfNote.size();
+    return count;
+}
+qint64 TrigramIndex::memoryUsage() const //estimated bytes, the set nodes like in TimeIndex::memoryUsage()
+{
+    qint64 bytes = memorySize(noteFiles);
+    for(const NoteFileIndex &index: noteFiles){
+        bytes += memorySize(index.postings) + memorySize(index.trigramsOfNote) + memorySize(index.texts); //the texts are shared with the notes
+        for(const QSet<int> &ids: index.postings) bytes += ids.size() * qint64(sizeof(int) + 2 * sizeof(void*));
+        for(const QVector<Trigram> &trigrams: index.trigramsOfNote) bytes += trigrams.capacity() * qint64(sizeof(Trigram));
+    }
+    return bytes;
+}
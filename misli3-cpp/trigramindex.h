@@ -0,0 +1,67 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+
+class Note;
+
+//An inverted index of the case folded trigrams of the note texts, one per
+//loaded notefile: trigram -> note ids. It's updated per changed note like the
+//TagIndex, so a search only has to verify the notes that have all the
+//trigrams of the query, instead of scanning every text on each keystroke.
+//The texts are kept too (shared with the notes), and all the containers are
+//implicitly shared, so a copy of the index is a cheap snapshot that the
+//search can read on its worker thread while the notes keep changing.
+class TrigramIndex
+{
+public:
+    typedef quint64 Trigram; //three UTF-16 code units
+
+    //Functions
+    void updateNotes(QString noteFileName, QHash<int, Note*> notes); //nullptr for the deleted ones
+    void removeNoteFile(QString name);
+    void renameNoteFile(QString oldName, QString newName);
+
+    QSet<int> candidates(QString noteFileName, QString query) const; //a superset of the matching notes
+    QString text(QString noteFileName, int id) const;
+    QStringList noteFileNames() const;
+    int noteCount() const;
+    qint64 memoryUsage() const;
+
+    static QVector<Trigram> trigrams(QString text); //sorted and unique
+
+    //Variables
+    quint64 version = 0; //bumped on every change, for the cached search results
+
+private:
+    struct NoteFileIndex{
+        QHash<Trigram, QSet<int>> postings;
+        QHash<int, QVector<Trigram>> trigramsOfNote; //to remove the old postings when a note changes
+        QHash<int, QString> texts;
+    };
+    void setText(NoteFileIndex &index, int id, QString text);
+    void removeNote(NoteFileIndex &index, int id);
+
+    QHash<QString, NoteFileIndex> noteFiles;
+};
+
+#endif // TRIGRAMINDEX_H
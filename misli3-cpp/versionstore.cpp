@@ -0,0 +1,398 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDir>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QCryptographicHash>
+
+#include "versionstore.h"
+
+static const quint32 packMagic = 0x4d534c50; //"MSLP"
+static const quint32 packVersion = 1;
+static const int hashSize = 20; //SHA1
+static const quint8 groupBoundaryByte = 4; //a group ends after a note hash starting with a lower byte (~64 notes per group)
+
+//Pruning: every version is kept for a day, then the last one per hour for a week,
+//then the last one per day up to the max age. The latest version is always kept
+static const qint64 keepAllSecs = 24*3600;
+static const qint64 keepHourlySecs = 7*24*3600;
+static const qint64 maxAgeSecs = 365*24*3600;
+static const qint64 pruneIntervalSecs = 24*3600;
+
+VersionStore::VersionStore(QString folderPath_)
+{
+    folderPath = folderPath_;
+}
+
+bool VersionStore::open()
+{
+    objectOffsets.clear();
+    versionOffsets.clear();
+    versionsFileStamps.clear();
+    packFile.close();
+
+    if(!QDir().mkpath(folderPath)){
+        qDebug()<<"[VersionStore::open]Failed making the history folder:"<<folderPath;
+        return false;
+    }
+
+    packFile.setFileName(QDir(folderPath).filePath("objects.pack"));
+    if(!packFile.open(QIODevice::ReadWrite)){
+        qDebug()<<"[VersionStore::open]Failed opening the pack file:"<<packFile.fileName();
+        return false;
+    }
+
+    QDataStream stream(&packFile);
+    if(packFile.size() == 0){
+        stream << packMagic << packVersion;
+        packFile.flush();
+        packStamp = fileStamp(packFile.fileName());
+        return true;
+    }
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if( (magic != packMagic) | (version != packVersion) ){
+        qDebug()<<"[VersionStore::open]Unknown pack format, the history is disabled:"<<packFile.fileName();
+        packFile.close();
+        return false;
+    }
+
+    //Index the objects. A record cut off by a crash gets truncated
+    qint64 goodEnd = packFile.pos();
+    while(!packFile.atEnd()){
+        QByteArray objectHash = packFile.read(hashSize);
+        quint32 size;
+        stream >> size;
+
+        qint64 sizeOffset = goodEnd + hashSize;
+        if( (objectHash.size() != hashSize) | (stream.status() != QDataStream::Ok) |
+                (sizeOffset + 4 + size > packFile.size()) ){
+            break;
+        }
+
+        objectOffsets.insert(objectHash, sizeOffset);
+        packFile.seek(sizeOffset + 4 + size);
+        goodEnd = packFile.pos();
+    }
+    if(goodEnd < packFile.size()){
+        qDebug()<<"[VersionStore::open]Truncating an incomplete record in"<<packFile.fileName();
+        packFile.resize(goodEnd);
+    }
+    packStamp = fileStamp(packFile.fileName());
+    return true;
+}
+
+QPair<qint64, QDateTime> VersionStore::fileStamp(QString filePath)
+{
+    QFileInfo info(filePath);
+    return qMakePair(info.size(), info.lastModified());
+}
+
+bool VersionStore::reindexIfReplaced(QString noteFileName) //before using the offsets, false if there's no pack
+{
+    if(fileStamp(packFile.fileName()) != packStamp){
+        qDebug()<<"[VersionStore::reindexIfReplaced]The pack changed on disk, reindexing:"<<packFile.fileName();
+        if(!open()) return false;
+    }
+    if( versionOffsets.contains(noteFileName) &&
+            (fileStamp(versionsFilePath(noteFileName)) != versionsFileStamps.value(noteFileName)) ){
+        versionOffsets.remove(noteFileName);
+    }
+    return packFile.isOpen();
+}
+
+QByteArray VersionStore::hash(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QByteArray VersionStore::storeObject(const QByteArray &data) //returns the hash, the data is written only once
+{
+    QByteArray objectHash = hash(data);
+    if(objectOffsets.contains(objectHash)) return objectHash;
+
+    packFile.seek(packFile.size());
+    packFile.write(objectHash);
+    objectOffsets.insert(objectHash, packFile.pos());
+
+    QDataStream out(&packFile);
+    out << quint32(data.size());
+    out.writeRawData(data.constData(), data.size());
+    packFile.flush();
+    packStamp = fileStamp(packFile.fileName());
+
+    return objectHash;
+}
+
+QByteArray VersionStore::readObject(const QByteArray &objectHash)
+{
+    qint64 offset = objectOffsets.value(objectHash, -1);
+    if(offset == -1) return QByteArray();
+
+    packFile.seek(offset);
+    QDataStream in(&packFile);
+    quint32 size;
+    in >> size;
+    return packFile.read(size);
+}
+
+QString VersionStore::versionsFilePath(QString noteFileName) //flat, the names of the notefiles in subfolders have '/'
+{
+    return QDir(folderPath).filePath(noteFileName.replace("%", "%25").replace("/", "%2F") + ".versions");
+}
+
+QList<qint64> &VersionStore::versionsOf(QString noteFileName) //the offsets of the versions in the notefile's log
+{
+    if(versionOffsets.contains(noteFileName)) return versionOffsets[noteFileName];
+
+    QList<qint64> &offsets = versionOffsets[noteFileName];
+
+    QFile versionsFile(versionsFilePath(noteFileName));
+    if(!versionsFile.open(QIODevice::ReadWrite)) return offsets; //no history yet
+
+    QDataStream in(&versionsFile);
+    qint64 goodEnd = 0;
+    while(!versionsFile.atEnd()){
+        qint64 msecs;
+        quint32 groupsCount;
+        in >> msecs >> groupsCount;
+
+        qint64 end = versionsFile.pos() + qint64(groupsCount) * hashSize;
+        if( (in.status() != QDataStream::Ok) | (end > versionsFile.size()) ) break;
+
+        offsets.push_back(goodEnd);
+        versionsFile.seek(end);
+        goodEnd = end;
+    }
+    if(goodEnd < versionsFile.size()) versionsFile.resize(goodEnd);
+    versionsFile.close();
+    versionsFileStamps.insert(noteFileName, fileStamp(versionsFile.fileName()));
+
+    return offsets;
+}
+
+bool VersionStore::readVersion(QString noteFileName, int index, Version &version)
+{
+    QList<qint64> &offsets = versionsOf(noteFileName);
+    if( (index < 0) | (index >= offsets.size()) ) return false;
+
+    QFile versionsFile(versionsFilePath(noteFileName));
+    if(!versionsFile.open(QIODevice::ReadOnly)) return false;
+    versionsFile.seek(offsets[index]);
+
+    QDataStream in(&versionsFile);
+    qint64 msecs;
+    quint32 groupsCount;
+    in >> msecs >> groupsCount;
+
+    version.time = QDateTime::fromMSecsSinceEpoch(msecs);
+    version.groupHashes.clear();
+    for(quint32 i=0; i<groupsCount; i++){
+        version.groupHashes.push_back(versionsFile.read(hashSize));
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+QList<VersionStore::Version> VersionStore::readAllVersions(QString noteFileName)
+{
+    QList<Version> versions;
+    for(int i=0; i<versionsOf(noteFileName).size(); i++){
+        Version version;
+        if(readVersion(noteFileName, i, version)) versions.push_back(version);
+    }
+    return versions;
+}
+
+void VersionStore::addVersion(QString noteFileName, QByteArrayList noteStates)
+{
+    if(!reindexIfReplaced(noteFileName)) return;
+
+    //Cut the note hashes into groups where the content says so, not by position
+    QByteArrayList groupHashes;
+    QByteArray group;
+    for(const QByteArray &state: noteStates){
+        QByteArray noteHash = storeObject(state);
+        group += noteHash;
+        if(quint8(noteHash[0]) < groupBoundaryByte){
+            groupHashes.push_back(storeObject(group));
+            group.clear();
+        }
+    }
+    if(!group.isEmpty()) groupHashes.push_back(storeObject(group));
+
+    //Nothing to record if it's the same as the last version
+    QList<qint64> &offsets = versionsOf(noteFileName);
+    Version lastVersion;
+    if(readVersion(noteFileName, offsets.size() - 1, lastVersion) && (lastVersion.groupHashes == groupHashes)) return;
+
+    QFile versionsFile(versionsFilePath(noteFileName));
+    if(!versionsFile.open(QIODevice::Append)){
+        qDebug()<<"[VersionStore::addVersion]Failed opening the versions file:"<<versionsFile.fileName();
+        return;
+    }
+    qint64 offset = versionsFile.size();
+
+    QDataStream out(&versionsFile);
+    out << QDateTime::currentMSecsSinceEpoch() << quint32(groupHashes.size());
+    for(const QByteArray &groupHash: groupHashes) out.writeRawData(groupHash.constData(), hashSize);
+    versionsFile.close();
+
+    offsets.push_back(offset);
+    versionsFileStamps.insert(noteFileName, fileStamp(versionsFile.fileName()));
+}
+
+int VersionStore::versionCount(QString noteFileName)
+{
+    if(!reindexIfReplaced(noteFileName)) return 0;
+    return versionsOf(noteFileName).size();
+}
+
+QDateTime VersionStore::versionTime(QString noteFileName, int index)
+{
+    if(!reindexIfReplaced(noteFileName)) return QDateTime();
+
+    Version version;
+    if(!readVersion(noteFileName, index, version)) return QDateTime();
+    return version.time;
+}
+
+QByteArrayList VersionStore::versionNoteStates(QString noteFileName, int index) //in the order they were saved
+{
+    QByteArrayList noteStates;
+    if(!reindexIfReplaced(noteFileName)) return noteStates;
+
+    Version version;
+    if(!readVersion(noteFileName, index, version)) return noteStates;
+
+    for(const QByteArray &groupHash: version.groupHashes){
+        QByteArray group = readObject(groupHash);
+        for(int i=0; i + hashSize <= group.size(); i += hashSize){
+            noteStates.push_back(readObject(group.mid(i, hashSize)));
+        }
+    }
+    return noteStates;
+}
+
+void VersionStore::renameNoteFile(QString oldName, QString newName)
+{
+    QFile::rename(versionsFilePath(oldName), versionsFilePath(newName));
+    versionOffsets.remove(oldName);
+    versionOffsets.remove(newName);
+    versionsFileStamps.remove(oldName);
+    versionsFileStamps.remove(newName);
+}
+
+void VersionStore::pruneIfDue()
+{
+    QFile prunedFile(QDir(folderPath).filePath("pruned")); //has the time of the last pruning
+    qint64 lastPruned = 0;
+    if(prunedFile.open(QIODevice::ReadOnly)){
+        lastPruned = prunedFile.readAll().trimmed().toLongLong();
+        prunedFile.close();
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if(lastPruned == 0){ //start counting on the first run
+        lastPruned = now;
+    }else if( (now - lastPruned) / 1000 > pruneIntervalSecs ){
+        prune();
+        lastPruned = now;
+    }
+
+    if(prunedFile.open(QIODevice::WriteOnly)) prunedFile.write(QByteArray::number(lastPruned));
+}
+
+void VersionStore::prune()
+{
+    if(!reindexIfReplaced(QString())) return;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch() / 1000;
+    QSet<QByteArray> reachableHashes;
+
+    //Thin out the versions of every notefile
+    for(QString fileName: QDir(folderPath).entryList(QStringList()<<"*.versions", QDir::Files)){
+        QString noteFileName = fileName.left(fileName.size() - QString(".versions").size());
+        noteFileName.replace("%2F", "/").replace("%25", "%");
+        if(!reindexIfReplaced(noteFileName)) return;
+        QList<Version> versions = readAllVersions(noteFileName);
+        QList<Version> keptVersions;
+
+        for(int i=0; i<versions.size(); i++){
+            qint64 time = versions[i].time.toMSecsSinceEpoch() / 1000;
+            qint64 age = now - time;
+            bool keep;
+
+            if( (i == versions.size() - 1) | (age < keepAllSecs) ){
+                keep = true;
+            }else if(age > maxAgeSecs){
+                keep = false;
+            }else{ //the last version in its hour (or day) bucket
+                qint64 bucket = (age < keepHourlySecs) ? 3600 : 24*3600;
+                qint64 nextTime = versions[i+1].time.toMSecsSinceEpoch() / 1000;
+                keep = (time / bucket) != (nextTime / bucket);
+            }
+            if(keep) keptVersions.push_back(versions[i]);
+        }
+
+        for(const Version &version: keptVersions){
+            for(const QByteArray &groupHash: version.groupHashes){
+                reachableHashes.insert(groupHash);
+                QByteArray group = readObject(groupHash);
+                for(int i=0; i + hashSize <= group.size(); i += hashSize) reachableHashes.insert(group.mid(i, hashSize));
+            }
+        }
+
+        if(keptVersions.size() == versions.size()) continue;
+
+        QSaveFile versionsFile(versionsFilePath(noteFileName));
+        if(!versionsFile.open(QIODevice::WriteOnly)) continue;
+        QDataStream out(&versionsFile);
+        for(const Version &version: keptVersions){
+            out << version.time.toMSecsSinceEpoch() << quint32(version.groupHashes.size());
+            for(const QByteArray &groupHash: version.groupHashes) out.writeRawData(groupHash.constData(), hashSize);
+        }
+        versionsFile.commit();
+        versionOffsets.remove(noteFileName);
+    }
+
+    if(reachableHashes.size() == objectOffsets.size()) return;
+
+    //Repack with only the reachable objects
+    QSaveFile newPackFile(packFile.fileName());
+    if(!newPackFile.open(QIODevice::WriteOnly)){
+        qDebug()<<"[VersionStore::prune]Failed repacking:"<<packFile.fileName();
+        return;
+    }
+    QDataStream out(&newPackFile);
+    out << packMagic << packVersion;
+    for(const QByteArray &objectHash: reachableHashes){
+        if(!objectOffsets.contains(objectHash)) continue; //listed by a version of a replaced pack
+        QByteArray data = readObject(objectHash);
+        out.writeRawData(objectHash.constData(), hashSize);
+        out << quint32(data.size());
+        out.writeRawData(data.constData(), data.size());
+    }
+
+    qDebug()<<"[VersionStore::prune]Dropped"<<objectOffsets.size() - reachableHashes.size()<<"objects.";
+    packFile.close();
+    newPackFile.commit();
+    open();
+}
@@ -0,0 +1,75 @@
+/*  This file is part of Misli.
+
+    Misli is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Misli is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Misli.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VERSIONSTORE_H
+#define VERSIONSTORE_H
+
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QDateTime>
+#include <QByteArrayList>
+
+//Content-addressed history of the notefiles, kept in the library folder.
+//Every note state is stored once in a pack file, keyed by its SHA1. A version
+//is a list of hashes of note groups (cut where a note hash starts with a low
+//byte, so inserting a note changes only its group), which in turn list the
+//note hashes. A saved version costs about the size of the changed notes.
+class VersionStore
+{
+public:
+    struct Version{
+        QDateTime time;
+        QByteArrayList groupHashes;
+    };
+
+    //Functions
+    VersionStore(QString folderPath);
+
+    bool open();
+    void addVersion(QString noteFileName, QByteArrayList noteStates);
+    int versionCount(QString noteFileName);
+    QDateTime versionTime(QString noteFileName, int index);
+    QByteArrayList versionNoteStates(QString noteFileName, int index);
+    void renameNoteFile(QString oldName, QString newName);
+    void pruneIfDue();
+    void prune();
+
+    static QByteArray hash(const QByteArray &data);
+
+    //Variables
+    QString folderPath;
+    QFile packFile;
+    QHash<QByteArray, qint64> objectOffsets; //hash -> offset of the data's size in the pack
+    QHash<QString, QList<qint64>> versionOffsets; //by notefile name, scanned on first access
+
+    //The size and modification time of the files as last indexed. The folder is
+    //synced, so another device may replace them and the offsets above go stale
+    QPair<qint64, QDateTime> packStamp;
+    QHash<QString, QPair<qint64, QDateTime>> versionsFileStamps;
+
+private:
+    static QPair<qint64, QDateTime> fileStamp(QString filePath);
+    bool reindexIfReplaced(QString noteFileName);
+    QByteArray storeObject(const QByteArray &data);
+    QByteArray readObject(const QByteArray &hash);
+    QString versionsFilePath(QString noteFileName);
+    QList<qint64> &versionsOf(QString noteFileName);
+    bool readVersion(QString noteFileName, int index, Version &version);
+    QList<Version> readAllVersions(QString noteFileName);
+};
+
+#endif // VERSIONSTORE_H